@@ -20,14 +20,70 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Timer wheel.
+
+   Pending timers are kept in a hierarchical timing wheel of
+   WHEEL_LEVELS levels of WHEEL_SIZE slots each.  Level 0 has a
+   slot for each of the next WHEEL_SIZE ticks.  Each slot of level
+   L covers WHEEL_SIZE times as many ticks as one of level L - 1,
+   so a timer goes into the level whose range its expiry falls
+   within, in the slot given by the bits of its expiry tick for
+   that level.  Adding or cancelling a timer is a list operation,
+   whatever the number of timers.
+
+   At each tick, the timers of the current level-0 slot have
+   expired.  Each time the level-0 slots wrap around, the timers
+   of the next slot of level 1 are spread over level 0 again, and
+   so on up the levels ("cascading").  Timers farther away than
+   the whole wheel covers go into the last level and are cascaded
+   down for as long as needed.
+
+   Expired timers are not run by the timer interrupt handler, but
+   by the timer thread that it wakes up, so that they can take
+   locks and sleep. */
+#define WHEEL_BITS 6                    /* log2 of WHEEL_SIZE. */
+#define WHEEL_SIZE (1 << WHEEL_BITS)    /* Slots per level. */
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4                  /* Number of levels. */
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static int64_t wheel_tick;      /* Next tick to expire timers of. */
+static struct list expired_list; /* Expired timers, not yet run. */
+static struct semaphore expired_sema; /* Ups timer thread. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Tickless idle.
+
+   While the idle thread halts, the periodic timer interrupt only
+   counts ticks.  So before halting, timer_idle_enter() switches
+   the 8254 to a one-shot countdown to the tick of the next pending
+   timer, or to the longest countdown the 8254 allows.  Every
+   external interrupt calls timer_idle_exit(), which counts the
+   ticks that went by and runs thread_tick() for each.  Once the
+   one-shot has gone off, it restores the periodic interrupt.  If
+   another interrupt came first, it sets a new one-shot to the end
+   of the current tick instead: switching from one-shot to
+   periodic mode before the countdown ends would raise a timer
+   interrupt of its own. */
+static uint16_t pit_count;      /* 8254 input clocks per tick. */
+static bool tickless;           /* In one-shot mode? */
+static uint16_t tickless_first; /* Clocks left in tick when entered. */
+static uint16_t tickless_count; /* Clocks counted down in one-shot. */
+static int64_t tickless_ticks;  /* # of ticks without an interrupt. */
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void wheel_insert (struct timer *);
+static bool wheel_advance (void);
+static void timer_thread (void *aux);
+static void wake_up (void *thread);
+static void pit_program (uint8_t mode, uint16_t count);
+static void tick (void);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
@@ -35,13 +91,18 @@ static void real_time_sleep (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  int level, slot;
+
   /* 8254 input frequency divided by TIMER_FREQ, rounded to
      nearest. */
-  uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+  pit_count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+  pit_program (2, pit_count);
 
-  outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-  outb (0x40, count & 0xff);
-  outb (0x40, count >> 8);
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+  list_init (&expired_list);
+  sema_init (&expired_sema, 0);
 
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -92,15 +153,197 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
-/* Suspends execution for approximately TICKS timer ticks. */
+/* Called by the idle thread, with interrupts off, right before
+   it halts with no thread ready.  Stops the periodic timer
+   interrupt until the next pending timer's tick, if that is more
+   than a tick away. */
+void
+timer_idle_enter (void) 
+{
+  int64_t deadline;
+  uint16_t left;
+  int max_ticks;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (tickless || !list_empty (&expired_list))
+    return;
+
+  /* Clocks left until the next tick.  The periodic countdown
+     runs from pit_count down to 1. */
+  outb (0x43, 0x00);    /* CW: latch counter 0. */
+  left = inb (0x40);
+  left |= inb (0x40) << 8;
+  if (left == 0 || left > pit_count)
+    return;
+
+  /* Find the next tick with a timer due, or a cascade that might
+     bring one, within what a 16-bit countdown reaches. */
+  max_ticks = 1 + (UINT16_MAX - left) / pit_count;
+  for (deadline = wheel_tick; deadline < ticks + max_ticks; deadline++)
+    if ((deadline & WHEEL_MASK) == 0
+        || !list_empty (&wheel[0][deadline & WHEEL_MASK]))
+      break;
+  if (deadline - ticks < 2)
+    return;
+
+  tickless = true;
+  tickless_first = left;
+  tickless_count = left + (deadline - ticks - 1) * pit_count;
+  pit_program (0, tickless_count);
+}
+
+/* Called at the start of every external interrupt.  If the idle
+   thread stopped the periodic timer interrupt, catches up with
+   the ticks that went by, and restores the periodic interrupt or
+   sets a one-shot to the end of the current tick. */
+void
+timer_idle_exit (void) 
+{
+  uint8_t status;
+  uint16_t left;
+  int64_t elapsed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!tickless)
+    return;
+
+  outb (0x43, 0xc2);    /* CW: read back status and count of counter 0. */
+  status = inb (0x40);
+  left = inb (0x40);
+  left |= inb (0x40) << 8;
+
+  if (status & 0x80)
+    {
+      /* The one-shot went off.  Its interrupt, this one or one
+         still pending, counts the last tick. */
+      elapsed = (tickless_count - tickless_first) / pit_count;
+      tickless = false;
+      pit_program (2, pit_count);
+    }
+  else 
+    {
+      uint16_t counted = tickless_count - left;
+      uint16_t rest;
+
+      if (counted < tickless_first)
+        {
+          elapsed = 0;
+          rest = tickless_first - counted;
+        }
+      else 
+        {
+          elapsed = 1 + (counted - tickless_first) / pit_count;
+          rest = pit_count - (counted - tickless_first) % pit_count;
+        }
+      tickless_first = tickless_count = rest;
+      pit_program (0, rest);
+    }
+
+  tickless_ticks += elapsed;
+  while (elapsed-- > 0)
+    tick ();
+}
+
+/* Starts the timer thread, which runs expired timers.  Until
+   then, expired timers wait. */
+void
+timer_start (void) 
+{
+  thread_create ("timer", PRI_MAX, timer_thread, NULL);
+}
+
+/* Initializes timer T to run FUNC, passing AUX, when it expires.
+   T is not pending. */
+void
+timer_setup (struct timer *t, timer_func *func, void *aux) 
+{
+  ASSERT (t != NULL);
+  ASSERT (func != NULL);
+
+  t->func = func;
+  t->aux = aux;
+  t->pending = false;
+}
+
+/* Adds timer T, which must have been set up and not be pending,
+   to expire DELAY timer ticks from now.  Its function then runs
+   in the timer thread, as soon as no thread of higher priority
+   is ready.
+
+   This function may be called from an interrupt handler. */
+void
+timer_add (struct timer *t, int64_t delay) 
+{
+  enum intr_level old_level;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (!t->pending);
+  t->expires = ticks + delay;
+  t->pending = true;
+  wheel_insert (t);
+  intr_set_level (old_level);
+}
+
+/* Cancels timer T.  Returns true if T was pending, false if it
+   was not, or if its function is running or has run already.
+
+   This function may be called from an interrupt handler. */
+bool
+timer_cancel (struct timer *t) 
+{
+  enum intr_level old_level;
+  bool pending;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  pending = t->pending;
+  if (pending)
+    {
+      list_remove (&t->elem);
+      t->pending = false;
+    }
+  intr_set_level (old_level);
+
+  return pending;
+}
+
+/* Returns true if timer T is pending. */
+bool
+timer_pending (const struct timer *t) 
+{
+  return t->pending;
+}
+
+/* Suspends execution for approximately TICKS timer ticks.  The
+   thread blocks until a timer wakes it up. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct timer timer;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  timer_setup (&timer, wake_up, thread_current ());
+  timer_add (&timer, ticks);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Timer function that wakes up THREAD, sleeping in
+   timer_sleep(). */
+static void
+wake_up (void *thread) 
+{
+  thread_unblock (thread);
 }
 
 /* Suspends execution for approximately MS milliseconds. */
@@ -128,15 +371,135 @@ timer_nsleep (int64_t ns)
 void
 timer_print_stats (void) 
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  printf ("Timer: %"PRId64" ticks, %"PRId64" without interrupt\n",
+          timer_ticks (), tickless_ticks);
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
+  tick ();
+}
+
+/* Counts a timer tick.  The timer thread is woken only after
+   thread_tick(), so that the MLFQS load average taken there does
+   not count it as ready on a tick where timers expire. */
+static void
+tick (void) 
+{
+  bool expired;
+
   ticks++;
+  expired = wheel_advance ();
   thread_tick ();
+  if (expired)
+    sema_up (&expired_sema);
+}
+
+/* Programs counter 0 of the 8254 to count down COUNT input
+   clocks in MODE: 0 to interrupt once, 2 to interrupt every
+   COUNT clocks. */
+static void
+pit_program (uint8_t mode, uint16_t count) 
+{
+  outb (0x43, 0x30 | (mode << 1)); /* CW: counter 0, LSB then MSB,
+                                      MODE, binary. */
+  outb (0x40, count & 0xff);
+  outb (0x40, count >> 8);
+}
+
+/* Puts pending timer T in the slot of the wheel for its expiry.
+   Must be called with interrupts turned off. */
+static void
+wheel_insert (struct timer *t) 
+{
+  int64_t expires = t->expires < wheel_tick ? wheel_tick : t->expires;
+  int64_t delta = expires - wheel_tick;
+  int level;
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+    expires = wheel_tick + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & WHEEL_MASK], &t->elem);
+}
+
+/* Moves the timers that expired up to the current tick from the
+   wheel to expired_list.  Returns true if any did, in which case
+   the caller wakes up the timer thread to run them.  Must be
+   called with interrupts turned off. */
+static bool
+wheel_advance (void) 
+{
+  bool expired = false;
+
+  while (wheel_tick <= ticks)
+    {
+      struct list *slot = &wheel[0][wheel_tick & WHEEL_MASK];
+
+      /* At the start of each round of level L - 1, cascade the
+         next slot of level L. */
+      if ((wheel_tick & WHEEL_MASK) == 0)
+        {
+          int level;
+
+          for (level = 1; level < WHEEL_LEVELS; level++)
+            {
+              int idx = (wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+              struct list *upper = &wheel[level][idx];
+
+              while (!list_empty (upper))
+                wheel_insert (list_entry (list_pop_front (upper),
+                                          struct timer, elem));
+              if (idx != 0)
+                break;
+            }
+        }
+
+      while (!list_empty (slot))
+        {
+          list_push_back (&expired_list, list_pop_front (slot));
+          expired = true;
+        }
+      wheel_tick++;
+    }
+
+  return expired;
+}
+
+/* Timer thread.  Runs the functions of expired timers. */
+static void
+timer_thread (void *aux UNUSED) 
+{
+  /* Stay ahead of other threads under the MLFQS scheduler too. */
+  thread_set_nice (NICE_MIN);
+
+  for (;;)
+    {
+      enum intr_level old_level;
+
+      sema_down (&expired_sema);
+      for (;;)
+        {
+          struct timer *t;
+
+          old_level = intr_disable ();
+          if (list_empty (&expired_list))
+            {
+              intr_set_level (old_level);
+              break;
+            }
+          t = list_entry (list_pop_front (&expired_list), struct timer, elem);
+          t->pending = false;
+          intr_set_level (old_level);
+
+          t->func (t->aux);
+        }
+    }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
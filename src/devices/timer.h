@@ -1,14 +1,38 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* Function a timer runs when it expires, given the timer's AUX. */
+typedef void timer_func (void *aux);
+
+/* A kernel timer.  Its owner must keep it in memory while it is
+   pending. */
+struct timer
+  {
+    int64_t expires;            /* Tick to run at. */
+    timer_func *func;           /* Function to run. */
+    void *aux;                  /* Argument to FUNC. */
+    bool pending;               /* Added, not yet run or cancelled. */
+    struct list_elem elem;      /* Element in timer wheel. */
+  };
+
 void timer_init (void);
 void timer_calibrate (void);
+void timer_start (void);
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+void timer_setup (struct timer *, timer_func *, void *aux);
+void timer_add (struct timer *, int64_t delay);
+bool timer_cancel (struct timer *);
+bool timer_pending (const struct timer *);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
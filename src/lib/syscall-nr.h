@@ -28,7 +28,11 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions, numbered after all of the above. */
+    SYS_FORK,                   /* Clone this process. */
+    SYS_MSYNC                   /* Write a memory mapping back to its file. */
   };
 
 #endif /* lib/syscall-nr.h */
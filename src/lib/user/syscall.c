@@ -153,6 +153,18 @@ munmap (mapid_t mapid)
   syscall1 (SYS_MUNMAP, mapid);
 }
 
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+void
+msync (mapid_t mapid)
+{
+  syscall1 (SYS_MSYNC, mapid);
+}
+
 bool
 chdir (const char *dir)
 {
@@ -0,0 +1,40 @@
+/* Forks a child that shares a large buffer copy-on-write with
+   its parent.  The child checks that it sees the parent's data
+   and then overwrites all of it.  The parent's copy must not
+   change. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  child = fork ();
+  if (child == 0)
+    {
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) (i % 251))
+          fail ("child read byte %zu as %d", i, buf[i]);
+      memset (buf, 'x', SIZE);
+      exit (0x42);
+    }
+
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == 0x42, "wait for child");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu changed to %d by child", i, buf[i]);
+  msg ("parent's buffer unchanged");
+}
@@ -0,0 +1,45 @@
+/* Writes to a file through a mapping and syncs it with msync,
+   then reads the data back using the read system call while the
+   file is still mapped.  Syncs again after writing the rest, and
+   after writing nothing. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  size_t size = strlen (sample);
+  size_t half = size / 2;
+  int handle;
+  mapid_t map;
+  char buf[1024];
+
+  CHECK (create ("sample.txt", size), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+
+  /* First half. */
+  memcpy (ACTUAL, sample, half);
+  msync (map);
+  read (handle, buf, half);
+  CHECK (!memcmp (buf, sample, half),
+         "compare first half against written data");
+
+  /* Rest, then a sync with nothing dirty. */
+  memcpy ((char *) ACTUAL + half, sample + half, size - half);
+  msync (map);
+  msync (map);
+  seek (handle, 0);
+  read (handle, buf, size);
+  CHECK (!memcmp (buf, sample, size),
+         "compare whole file against written data");
+
+  munmap (map);
+  close (handle);
+}
@@ -19,10 +19,12 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "vm/swap.h"
 #include "vm/s-pagetable.h"
 #include "vm/frame.h"
+#include "vm/file-table.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -89,6 +91,7 @@ main (void)
   /* Initialize memory system. */
   palloc_init ();
   malloc_init ();
+  slab_init ();
   paging_init ();
   
 
@@ -113,6 +116,7 @@ main (void)
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
+  timer_start ();
 
 #ifdef FILESYS
   /* Initialize file system. */
@@ -121,7 +125,8 @@ main (void)
 #endif
   swap_init ();
   frametable_init();
-  init_s_page_table();
+  s_pte_init();
+  file_table_init();
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -395,6 +400,8 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
+  slab_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
 #endif
@@ -353,6 +353,10 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* Catch up with ticks missed while idle, before any
+         handler looks at the time. */
+      timer_idle_exit ();
     }
 
   /* Invoke the interrupt's handler. */
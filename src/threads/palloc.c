@@ -2,12 +2,14 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -23,30 +25,81 @@
    even if user processes are swapping like mad.
 
    By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   half to the user pool.  That is overkill for the kernel pool
+   most of the time, so when the user pool runs out, user pages
+   are lent from the kernel pool, as long as the kernel pool keeps
+   kernel_reserve free pages for itself.  A lent page goes back to
+   the kernel pool when it is freed.
+
+   Each pool is a buddy system.  A free block of order K is 2**K
+   pages, aligned to its size relative to the pool base, and sits
+   on the free list of its order.  An allocation takes the first
+   block of a large enough order, splits it in halves down to the
+   order it needs, and gives back the pages past the request.
+   Freeing merges a block with its buddy as long as the buddy is
+   free too.  Both take O(log n) time, whatever the pool size.
+   A request larger than the largest block falls back to a
+   first-fit scan of the pool's bitmap, like the original
+   allocator.
+
+   Each pool also keeps up to ZERO_PAGES_MAX free pages that are
+   already zeroed, refilled by the idle thread, so that single
+   PAL_ZERO pages usually need no memset().  They are taken off the
+   buddy system, and given out for any request once the rest of
+   the pool is used up. */
+
+/* Number of block orders: the largest block is 2**(PALLOC_ORDERS
+   - 1) pages.  palloc_get_multiple() scans the bitmap for more. */
+#define PALLOC_ORDERS 11
+
+/* order_map entry of a page that does not begin a free block. */
+#define ORDER_NONE UINT8_MAX
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *order_map;                 /* Order of the free block
+                                           beginning at each page. */
+    struct list free_list[PALLOC_ORDERS]; /* Free blocks by order. */
+    size_t free_blocks[PALLOC_ORDERS];  /* Length of each free list. */
+    size_t page_cnt;                    /* Number of pages. */
+    size_t free_cnt;                    /* Number of free pages. */
+    struct list zero_list;              /* Zeroed free pages. */
+    size_t zero_cnt;                    /* Length of zero_list. */
     uint8_t *base;                      /* Base of pool. */
   };
 
+/* Most zeroed pages kept by a pool. */
+#define ZERO_PAGES_MAX 16
+
 /* Two pools: one for kernel data, one for user pages. */
 struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
 
+/* Free kernel pool pages never lent to the user pool: a quarter
+   of the kernel pool, but at least KERNEL_RESERVE_MIN pages. */
+#define KERNEL_RESERVE_MIN 32
+static size_t kernel_reserve;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+static bool page_from_pool (const struct pool *, const void *page);
+static size_t pool_get (struct pool *, size_t page_cnt);
+static size_t pool_get_scan (struct pool *, size_t page_cnt);
+static void pool_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void push_block (struct pool *, size_t page_idx, int order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void *lend_kernel_pages (size_t page_cnt);
+static void *zero_page_get (struct pool *);
+static bool zero_page_refill (struct pool *);
 
 /* Initializes the page allocator. */
 void
-palloc_init (void) 
+palloc_init (void)
 {
   /* End of the kernel as recorded by the linker.
      See kernel.lds.S. */
@@ -66,14 +119,20 @@ palloc_init (void)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+
+  kernel_reserve = kernel_pool.page_cnt / 4;
+  if (kernel_reserve < KERNEL_RESERVE_MIN)
+    kernel_reserve = KERNEL_RESERVE_MIN;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the pages are filled with zeros.  If too few pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   otherwise from the kernel pool.  User pages are lent from the
+   kernel pool if the user pool is out of pages.  If PAL_ZERO is
+   set in FLAGS, then the pages are filled with zeros, or a single
+   page is taken already zeroed from the pool.  If too few pages
+   are available, returns a null pointer, unless PAL_ASSERT is set
+   in FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
@@ -84,8 +143,15 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   if (page_cnt == 0)
     return NULL;
 
+  if (page_cnt == 1 && (flags & PAL_ZERO))
+    {
+      pages = zero_page_get (pool);
+      if (pages != NULL)
+        return pages;
+    }
+
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  page_idx = pool_get (pool, page_cnt);
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR){
@@ -94,14 +160,19 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   }
 
   else
-    pages = NULL;
+    {
+      /* Use up the zeroed pages before lending. */
+      pages = page_cnt == 1 ? zero_page_get (pool) : NULL;
+      if (pages == NULL && (flags & PAL_USER))
+        pages = lend_kernel_pages (page_cnt);
+    }
 
-  if (pages != NULL) 
+  if (pages != NULL)
     {
       if (flags & PAL_ZERO)
         memset (pages, 0, PGSIZE * page_cnt);
     }
-  else 
+  else
     {
       if (flags & PAL_ASSERT)
         PANIC ("palloc_get: out of pages");
@@ -118,14 +189,31 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *
-palloc_get_page (enum palloc_flags flags) 
+palloc_get_page (enum palloc_flags flags)
 {
   return palloc_get_multiple (flags, 1);
 }
 
+/* Takes PAGE_CNT contiguous pages of the kernel pool for the user
+   pool, or returns a null pointer if that would leave fewer than
+   kernel_reserve free pages to the kernel. */
+static void *
+lend_kernel_pages (size_t page_cnt)
+{
+  struct pool *pool = &kernel_pool;
+  size_t page_idx = BITMAP_ERROR;
+
+  lock_acquire (&pool->lock);
+  if (pool->free_cnt >= kernel_reserve + page_cnt)
+    page_idx = pool_get (pool, page_cnt);
+  lock_release (&pool->lock);
+
+  return page_idx != BITMAP_ERROR ? pool->base + PGSIZE * page_idx : NULL;
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
-palloc_free_multiple (void *pages, size_t page_cnt) 
+palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
@@ -147,26 +235,177 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  lock_acquire (&pool->lock);
+  pool_free (pool, page_idx, page_cnt);
+  lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
 void
-palloc_free_page (void *page) 
+palloc_free_page (void *page)
 {
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of pages in the user pool. */
+size_t
+palloc_user_page_cnt (void)
+{
+  return user_pool.page_cnt;
+}
+
+/* Returns the number of pages a user page can be allocated from:
+   the free pages of the user pool, plus the free kernel pool
+   pages above the kernel reserve. */
+size_t
+palloc_user_free_cnt (void)
+{
+  size_t kernel_free = kernel_pool.free_cnt;
+  size_t lendable = kernel_free > kernel_reserve
+                    ? kernel_free - kernel_reserve : 0;
+  return user_pool.free_cnt + user_pool.zero_cnt + lendable;
+}
+
+/* Returns the number of pages that may hold user pages, those of
+   both pools, since kernel pool pages may be lent. */
+size_t
+palloc_frame_cnt (void)
+{
+  return kernel_pool.page_cnt + user_pool.page_cnt;
+}
+
+/* Returns the index of PAGE among the palloc_frame_cnt() pages,
+   kernel pool first, or SIZE_MAX if PAGE belongs to no pool. */
+size_t
+palloc_frame_idx (const void *page)
+{
+  if (page_from_pool (&kernel_pool, page))
+    return pg_no (page) - pg_no (kernel_pool.base);
+  if (page_from_pool (&user_pool, page))
+    return kernel_pool.page_cnt + (pg_no (page) - pg_no (user_pool.base));
+  return SIZE_MAX;
+}
+
+/* Returns the kernel virtual address of the page at index IDX.
+   The inverse of palloc_frame_idx(). */
+void *
+palloc_frame_page (size_t idx)
+{
+  ASSERT (idx < palloc_frame_cnt ());
+  if (idx < kernel_pool.page_cnt)
+    return kernel_pool.base + idx * PGSIZE;
+  return user_pool.base + (idx - kernel_pool.page_cnt) * PGSIZE;
+}
+
+/* Zeroes a free page for a later PAL_ZERO request, if a pool
+   has room for one.  Returns false if there was nothing to do or
+   a pool was busy.  Called by the idle thread, so it never
+   blocks nor holds a lock. */
+bool
+palloc_zero_refill (void)
+{
+  return zero_page_refill (&user_pool) || zero_page_refill (&kernel_pool);
+}
+
+/* Takes a zeroed page off POOL's zero_list and returns it, or
+   returns a null pointer if there is none. */
+static void *
+zero_page_get (struct pool *pool)
+{
+  enum intr_level old_level;
+  struct list_elem *e = NULL;
+
+  /* The idle thread cannot wait on the pool lock, so zero_list
+     is protected by turning off interrupts instead. */
+  old_level = intr_disable ();
+  if (!list_empty (&pool->zero_list))
+    {
+      e = list_pop_front (&pool->zero_list);
+      pool->zero_cnt--;
+    }
+  intr_set_level (old_level);
+
+  /* Clear the list element the page held. */
+  if (e != NULL)
+    memset (e, 0, sizeof *e);
+  return e;
+}
+
+/* Zeroes a free page of POOL and puts it on POOL's zero_list,
+   unless the list is full, POOL is locked, or POOL has too few
+   free pages left to spare one.  Returns true if it did.
+
+   The idle thread must not take the pool lock: preempted while
+   holding it, it would not run again before every other thread
+   blocks, and threads waiting for the lock would donate to it.
+   With interrupts off no other thread can take the lock, so the
+   page is taken then, if the lock is free, without taking it. */
+static bool
+zero_page_refill (struct pool *pool)
+{
+  enum intr_level old_level;
+  size_t page_idx = BITMAP_ERROR;
+  struct list_elem *e;
+
+  old_level = intr_disable ();
+  if (pool->zero_cnt < ZERO_PAGES_MAX && pool->lock.holder == NULL
+      && pool->free_cnt > ZERO_PAGES_MAX)
+    page_idx = pool_get (pool, 1);
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  e = (struct list_elem *) (pool->base + PGSIZE * page_idx);
+  memset (e, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  list_push_back (&pool->zero_list, e);
+  pool->zero_cnt++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Returns the number of free blocks of 2**ORDER pages in the user
+   pool if USER, otherwise in the kernel pool. */
+size_t
+palloc_free_block_cnt (bool user, int order)
+{
+  ASSERT (order >= 0 && order < PALLOC_ORDERS);
+  return (user ? &user_pool : &kernel_pool)->free_blocks[order];
+}
+
+/* Prints the free pages of each pool, and its free blocks by
+   order, smallest first. */
+void
+palloc_print_stats (void)
+{
+  struct pool *pools[] = { &kernel_pool, &user_pool };
+  const char *names[] = { "Kernel", "User" };
+  int i, order;
+
+  for (i = 0; i < 2; i++)
+    {
+      printf ("%s pool: %zu of %zu pages free, %zu zeroed, "
+              "blocks by order:", names[i], pools[i]->free_cnt,
+              pools[i]->page_cnt, pools[i]->zero_cnt);
+      for (order = 0; order < PALLOC_ORDERS; order++)
+        printf (" %zu", pools[i]->free_blocks[order]);
+      printf ("\n");
+    }
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and order_map at its base.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -175,18 +414,215 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->order_map = (uint8_t *) base + bm_size;
+  memset (p->order_map, ORDER_NONE, page_cnt);
+  for (order = 0; order < PALLOC_ORDERS; order++)
+    {
+      list_init (&p->free_list[order]);
+      p->free_blocks[order] = 0;
+    }
+  p->page_cnt = page_cnt;
+  p->free_cnt = 0;
+  list_init (&p->zero_list);
+  p->zero_cnt = 0;
   p->base = base + bm_pages * PGSIZE;
+
+  /* All pages start out allocated, free them as the largest
+     aligned blocks that fit. */
+  bitmap_set_all (p->used_map, true);
+  pool_free (p, 0, page_cnt);
+}
+
+/* Returns the order of the smallest block of at least PAGE_CNT
+   pages, or PALLOC_ORDERS if there is none. */
+static int
+order_for (size_t page_cnt)
+{
+  int order = 0;
+
+  while (order < PALLOC_ORDERS && ((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Returns the free block header stored in the first page of the
+   block at PAGE_IDX of POOL. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the page index of free block header E of POOL. */
+static size_t
+block_idx (struct pool *pool, struct list_elem *e)
+{
+  return ((uint8_t *) e - pool->base) / PGSIZE;
+}
+
+/* Puts the block of 2**ORDER pages at PAGE_IDX of POOL on the free
+   list of ORDER, as it is: no buddy is merged. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order)
+{
+  pool->order_map[page_idx] = order;
+  list_push_front (&pool->free_list[order], block_elem (pool, page_idx));
+  pool->free_blocks[order]++;
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX of POOL off
+   its free list. */
+static void
+pop_block (struct pool *pool, size_t page_idx, int order)
+{
+  ASSERT (pool->order_map[page_idx] == order);
+  pool->order_map[page_idx] = ORDER_NONE;
+  list_remove (block_elem (pool, page_idx));
+  pool->free_blocks[order]--;
+}
+
+/* Allocates PAGE_CNT contiguous pages of POOL and returns the
+   index of the first one, or BITMAP_ERROR if there is no free
+   block large enough.  Called with POOL's lock held. */
+static size_t
+pool_get (struct pool *pool, size_t page_cnt)
+{
+  int want = order_for (page_cnt);
+  int order;
+  size_t page_idx;
+
+  if (want >= PALLOC_ORDERS)
+    return pool_get_scan (pool, page_cnt);
+
+  for (order = want; order < PALLOC_ORDERS; order++)
+    if (!list_empty (&pool->free_list[order]))
+      break;
+  if (order >= PALLOC_ORDERS)
+    return BITMAP_ERROR;
+
+  page_idx = block_idx (pool, list_front (&pool->free_list[order]));
+  pop_block (pool, page_idx, order);
+
+  /* Split down to the order wanted, the upper halves stay free. */
+  while (order > want)
+    {
+      order--;
+      push_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+
+  ASSERT (!bitmap_any (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+  pool->free_cnt -= page_cnt;
+
+  /* Give back the pages past the request. */
+  free_range (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+  return page_idx;
+}
+
+/* Allocates PAGE_CNT contiguous pages of POOL, more than the
+   largest block, from the first run of free pages in used_map,
+   and returns the index of the first one, or BITMAP_ERROR if
+   there is no such run.  Takes O(n) time, but such requests are
+   rare.  Called with POOL's lock held. */
+static size_t
+pool_get_scan (struct pool *pool, size_t page_cnt)
+{
+  size_t page_idx = bitmap_scan (pool->used_map, 0, page_cnt, false);
+  size_t end = page_idx + page_cnt;
+  size_t head = page_idx;
+  size_t idx;
+
+  if (page_idx == BITMAP_ERROR)
+    return BITMAP_ERROR;
+
+  /* Take every free block that overlaps the run off its free
+     list.  The block holding free page IDX is the one of the
+     order found at IDX rounded down to that order. */
+  for (idx = page_idx; idx < end; )
+    {
+      size_t start = idx;
+      int order;
+
+      for (order = 0; order < PALLOC_ORDERS; order++)
+        {
+          start = idx & ~(((size_t) 1 << order) - 1);
+          if (pool->order_map[start] == order)
+            break;
+        }
+      ASSERT (order < PALLOC_ORDERS);
+      if (idx == page_idx)
+        head = start;
+      pop_block (pool, start, order);
+      idx = start + ((size_t) 1 << order);
+    }
+
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+  pool->free_cnt -= page_cnt;
+
+  /* Give back the pages of those blocks outside the run. */
+  free_range (pool, head, page_idx - head);
+  free_range (pool, end, idx - end);
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX of POOL, which must be
+   allocated.  Called with POOL's lock held. */
+static void
+pool_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
+  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  pool->free_cnt += page_cnt;
+  free_range (pool, page_idx, page_cnt);
+}
+
+/* Puts the free pages [PAGE_IDX, PAGE_IDX + PAGE_CNT) of POOL on
+   the free lists, as the largest aligned blocks that fit, each
+   merged with its buddy for as long as the buddy is free.
+   used_map and free_cnt already count the pages as free. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+      size_t idx = page_idx;
+      size_t size;
+
+      while (order + 1 < PALLOC_ORDERS
+             && (page_idx & ((size_t) 1 << order)) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      size = (size_t) 1 << order;
+      page_idx += size;
+      page_cnt -= size;
+
+      /* Coalesce. */
+      while (order + 1 < PALLOC_ORDERS)
+        {
+          size_t buddy = idx ^ ((size_t) 1 << order);
+
+          if (buddy + ((size_t) 1 << order) > pool->page_cnt
+              || pool->order_map[buddy] != order)
+            break;
+          pop_block (pool, buddy, order);
+          idx &= ~((size_t) 1 << order);
+          order++;
+        }
+      push_block (pool, idx, order);
+    }
 }
 
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
-page_from_pool (const struct pool *pool, void *page) 
+page_from_pool (const struct pool *pool, const void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
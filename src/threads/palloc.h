@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -19,5 +20,13 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+size_t palloc_user_page_cnt (void);
+size_t palloc_user_free_cnt (void);
+size_t palloc_frame_cnt (void);
+size_t palloc_frame_idx (const void *);
+void *palloc_frame_page (size_t idx);
+size_t palloc_free_block_cnt (bool user, int order);
+bool palloc_zero_refill (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
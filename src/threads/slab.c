@@ -0,0 +1,210 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator for the kernel objects that are allocated and
+   freed all the time, such as supplemental page table entries
+   and inodes.
+
+   Each object type gets its own cache.  A cache hands out
+   objects from "slabs", pages obtained from the page allocator,
+   each holding as many objects as fit after a slab header.  The
+   header keeps the free objects of the slab as a stack of object
+   indexes, so free objects need not be touched, and keep the
+   state the cache constructor put them in.
+
+   Unlike malloc(), a cache takes no lock: the free stacks are
+   only a few instructions long, so they run with interrupts
+   off.  Interrupts are on while a new slab is obtained and
+   constructed, or an empty one given back to the page
+   allocator.
+
+   A cache keeps the slabs that have free objects on a list, the
+   slab last freed into first.  A slab that becomes empty is given
+   back to the page allocator, unless it is the only slab the
+   cache has with free objects. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of the slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's slabs. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint8_t *objs;              /* First object. */
+    uint16_t free[];            /* Indexes of free objects,
+                                   first FREE_CNT entries. */
+  };
+
+/* All caches, for statistics. */
+static struct list caches;
+
+/* Returns the offset of the first object in a slab of OBJ_CNT
+   objects. */
+static size_t
+objs_ofs (size_t obj_cnt)
+{
+  return ROUND_UP (sizeof (struct slab) + obj_cnt * sizeof (uint16_t),
+                   sizeof (void *));
+}
+
+/* Initializes the slab allocator. */
+void
+slab_init (void)
+{
+  list_init (&caches);
+}
+
+/* Initializes cache C of objects of SIZE bytes, named NAME,
+   each constructed by CTOR unless it is a null pointer.  Takes
+   no memory until the first object is allocated. */
+void
+slab_cache_init (struct slab_cache *c, const char *name, size_t size,
+                 slab_ctor_func *ctor)
+{
+  enum intr_level old_level;
+
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, sizeof (void *));
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab))
+                     / (c->obj_size + sizeof (uint16_t));
+  while (c->objs_per_slab > 0
+         && objs_ofs (c->objs_per_slab) + c->objs_per_slab * c->obj_size
+            > PGSIZE)
+    c->objs_per_slab--;
+  ASSERT (c->objs_per_slab > 0);
+  c->ctor = ctor;
+  list_init (&c->slabs);
+  c->slab_cnt = 0;
+  c->obj_cnt = 0;
+  c->alloc_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&caches, &c->elem);
+  intr_set_level (old_level);
+}
+
+/* Obtains a page from the page allocator and makes it a slab of
+   cache C, with all its objects free and constructed.  Returns a
+   null pointer if memory is not available. */
+static struct slab *
+slab_create (struct slab_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  s->objs = (uint8_t *) s + objs_ofs (c->objs_per_slab);
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      /* Hand out objects from the start of the page first. */
+      s->free[i] = c->objs_per_slab - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor (s->objs + i * c->obj_size);
+    }
+  return s;
+}
+
+/* Obtains and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *c)
+{
+  enum intr_level old_level;
+  struct slab *s;
+  void *obj;
+
+  old_level = intr_disable ();
+  if (list_empty (&c->slabs))
+    {
+      struct slab *new;
+
+      intr_set_level (old_level);
+      new = slab_create (c);
+      if (new == NULL)
+        return NULL;
+      old_level = intr_disable ();
+      list_push_front (&c->slabs, &new->elem);
+      c->slab_cnt++;
+    }
+
+  s = list_entry (list_front (&c->slabs), struct slab, elem);
+  ASSERT (s->free_cnt > 0);
+  obj = s->objs + s->free[--s->free_cnt] * c->obj_size;
+  if (s->free_cnt == 0)
+    list_remove (&s->elem);
+  c->obj_cnt++;
+  c->alloc_cnt++;
+  intr_set_level (old_level);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C, to C.
+   Does nothing if OBJ is a null pointer. */
+void
+slab_free (struct slab_cache *c, void *obj)
+{
+  enum intr_level old_level;
+  struct slab *s;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  idx = ((uint8_t *) obj - s->objs) / c->obj_size;
+  ASSERT (s->objs + idx * c->obj_size == obj);
+
+  old_level = intr_disable ();
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  if (s->free_cnt == 0)
+    list_push_front (&c->slabs, &s->elem);
+  s->free[s->free_cnt++] = idx;
+  c->obj_cnt--;
+
+  if (s->free_cnt == c->objs_per_slab
+      && list_begin (&c->slabs) != list_rbegin (&c->slabs))
+    {
+      /* Empty, and not the only slab with free objects. */
+      list_remove (&s->elem);
+      c->slab_cnt--;
+      intr_set_level (old_level);
+      s->magic = 0;
+      palloc_free_page (s);
+    }
+  else
+    intr_set_level (old_level);
+}
+
+/* Prints statistics about each cache. */
+void
+slab_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      printf ("Slab %s: %zu-byte objects, %zu in use, %zu slabs, "
+              "%"PRIu64" allocations\n",
+              c->name, c->obj_size, c->obj_cnt, c->slab_cnt, c->alloc_cnt);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Constructor run once on each object of a new slab.  Objects
+   go back to the cache in their constructed state. */
+typedef void slab_ctor_func (void *obj);
+
+/* A cache of objects of one size. */
+struct slab_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Object size, rounded up. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    slab_ctor_func *ctor;       /* Constructor, or a null pointer. */
+    struct list slabs;          /* Slabs with free objects. */
+    struct list_elem elem;      /* Element in list of all caches. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Slabs allocated. */
+    size_t obj_cnt;             /* Objects in use. */
+    uint64_t alloc_cnt;         /* Total allocations. */
+  };
+
+void slab_init (void);
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      slab_ctor_func *);
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -102,8 +102,32 @@ sema_try_down (struct semaphore *sema)
   return success;
 }
 
+/* Returns true if the thread of list element A_ has a lower
+   priority than that of B_. */
+static bool
+priority_less (const struct list_elem *a_, const struct list_elem *b_,
+               void *aux UNUSED) 
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority < b->priority;
+}
+
+/* Returns the highest priority of the threads waiting for SEMA,
+   or PRI_MIN - 1 if there are none. */
+static int
+waiters_priority (struct semaphore *sema) 
+{
+  if (list_empty (&sema->waiters))
+    return PRI_MIN - 1;
+  return list_entry (list_max (&sema->waiters, priority_less, NULL),
+                     struct thread, elem)->priority;
+}
+
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest priority thread of those waiting for
+   SEMA, if any, the one that waited longest among equals.
 
    This function may be called from an interrupt handler. */
 void
@@ -115,10 +139,16 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct list_elem *e = list_max (&sema->waiters, priority_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+
+  /* The thread woken up may have a higher priority. */
+  thread_preempt ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -180,12 +210,56 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->priority = PRI_MIN - 1;
+}
+
+/* Donates the running thread's priority to the holder of LOCK,
+   which the running thread is about to wait for.  If that holder
+   waits for a lock too, the donation is passed on to its holder,
+   and so on, through LOCK_DONATION_DEPTH locks at most.
+   Must be called with interrupts turned off. */
+static void
+lock_donate (struct lock *lock) 
+{
+  int priority = thread_current ()->priority;
+  int depth;
+
+  for (depth = 0; lock != NULL && depth < LOCK_DONATION_DEPTH; depth++)
+    {
+      if (lock->priority >= priority)
+        break;
+      lock->priority = priority;
+      if (lock->holder == NULL)
+        break;
+      thread_refresh_priority (lock->holder);
+      lock = lock->holder->wait_lock;
+    }
+}
+
+/* Makes the running thread the holder of LOCK, which it has just
+   downed the semaphore of.  The threads still waiting keep
+   donating their priority.
+   Must be called with interrupts turned off. */
+static void
+lock_take (struct lock *lock) 
+{
+  struct thread *curr = thread_current ();
+
+  lock->holder = curr;
+  lock->priority = waiters_priority (&lock->semaphore);
+  list_push_back (&curr->locks, &lock->elem);
+  if (!thread_mlfqs)
+    thread_refresh_priority (curr);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While it sleeps, the current thread donates its priority to
+   the holder of LOCK, so that a lower priority holder cannot keep
+   it waiting behind threads of priorities in between.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -193,12 +267,23 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *curr = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      curr->wait_lock = lock;
+      lock_donate (lock);
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  curr->wait_lock = NULL;
+  lock_take (lock);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -210,18 +295,22 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    lock_take (lock);
+  intr_set_level (old_level);
   return success;
 }
 
-/* Releases LOCK, which must be owned by the current thread.
+/* Releases LOCK, which must be owned by the current thread,
+   and gives up the priority donated through it.
    This is lock_release function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -230,11 +319,18 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   lock->holder = NULL;
+  list_remove (&lock->elem);
+  if (!thread_mlfqs)
+    thread_refresh_priority (thread_current ());
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -253,8 +349,23 @@ struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
+/* Returns true if the thread waiting on semaphore_elem A_ has a
+   lower priority than that of B_. */
+static bool
+waiter_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct semaphore_elem *a
+    = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b
+    = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority < b->thread->priority;
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -297,6 +408,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -304,7 +416,8 @@ cond_wait (struct condition *cond, struct lock *lock)
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the highest priority one of them to wake
+   up from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -319,8 +432,11 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_max (&cond->waiters, waiter_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -17,11 +17,17 @@ bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
+/* Most locks a priority donation is passed on through, when the
+   holder of a lock waits for another lock, and so on. */
+#define LOCK_DONATION_DEPTH 8
+
 /* Lock. */
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* Element in holder's locks. */
+    int priority;               /* Highest priority donated by a waiter. */
   };
 
 void lock_init (struct lock *);
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
@@ -11,6 +12,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -24,9 +26,19 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue: lists of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running, one
+   list per priority.  Bit P of ready_map is set if
+   ready_list[P] is nonempty, so the highest priority with a ready
+   thread is found with a single bit scan. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+static struct list ready_list[PRI_CNT];
+static uint32_t ready_map[DIV_ROUND_UP (PRI_CNT, 32)];
+static size_t ready_cnt;        /* # of threads in run queue. */
+
+/* List of all processes.  Processes are added to this list
+   when they are created and removed when they exit. */
+static struct list all_list;
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -59,11 +71,33 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler.  Every thread's priority
+   is computed from its niceness and its recent_cpu, an average of
+   the CPU time it got lately, which decays once a second by a
+   factor that depends on load_avg, the average number of threads
+   ready to run.
+
+   A thread's priority is recomputed every MLFQS_PRIORITY_TICKS
+   ticks, but only if its recent_cpu changed, that is, if it ran
+   since.  Those threads are kept on dirty_list.  Once a second,
+   when the recent_cpu of all threads decays, all priorities are
+   recomputed. */
+#define MLFQS_PRIORITY_TICKS 4  /* # of ticks between updates. */
+static fixed_t load_avg;        /* Average # of ready threads. */
+static struct list dirty_list;  /* Threads whose recent_cpu changed. */
+
+static void mlfqs_tick (struct thread *);
+static int mlfqs_priority (const struct thread *);
+static void mlfqs_update_priority (struct thread *);
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
@@ -87,10 +121,15 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_list[i]);
+  list_init (&all_list);
+  list_init (&dirty_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -135,6 +174,9 @@ thread_tick (void)
 #endif
   else
     kernel_ticks++;
+
+  if (thread_mlfqs)
+    mlfqs_tick (t);
   
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE){
@@ -163,9 +205,8 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   The new thread preempts the running thread if PRIORITY is
+   higher than the running thread's. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -203,6 +244,7 @@ thread_create (const char *name, int priority,
 
   /* Add to run queue. */
   thread_unblock (t);
+  thread_preempt ();
 
   return tid;
 }
@@ -228,10 +270,12 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   This function does not preempt the running thread, except
+   from an interrupt handler, where it yields on return from the
+   interrupt if T has a higher priority.  This can be important:
+   if the caller had disabled interrupts itself, it may expect
+   that it can atomically unblock a thread and update other data.
+   Callers call thread_preempt() when they are done. */
 void
 thread_unblock (struct thread *t) 
 {
@@ -242,8 +286,10 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem); 
+  ready_push (t);
   t->status = THREAD_READY;
+  if (intr_context () && t->priority > thread_current ()->priority)
+    intr_yield_on_return ();
   intr_set_level (old_level);
 }
 
@@ -294,6 +340,9 @@ thread_exit (void)
   /* Just set our status to dying and schedule another process.
      We will be destroyed during the call to schedule_tail(). */
   intr_disable ();
+  list_remove (&thread_current ()->allelem);
+  if (thread_current ()->cpu_dirty)
+    list_remove (&thread_current ()->dirty_elem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -311,17 +360,96 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (curr != idle_thread) 
-    list_push_back (&ready_list, &curr->elem);
+    ready_push (curr);
   curr->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Yields the CPU if a thread of higher priority than the running
+   thread is ready.  In an interrupt handler, yields on return
+   from the interrupt instead. */
+void
+thread_preempt (void) 
+{
+  enum intr_level old_level;
+  bool preempt;
+
+  old_level = intr_disable ();
+  preempt = ready_max_priority () > thread_current ()->priority;
+  intr_set_level (old_level);
+
+  if (!preempt)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_yield ();
+}
+
+/* Sets the current thread's base priority to NEW_PRIORITY, and
+   yields if a ready thread now has a higher priority.  Priority
+   donated to the thread stays in effect until it releases the
+   locks it was donated through.  Does nothing under the MLFQS
+   scheduler. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  struct thread *curr = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  /* The MLFQS scheduler sets priorities itself. */
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  curr->base_priority = new_priority;
+  thread_refresh_priority (curr);
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Recomputes T's priority as the highest of its base priority
+   and the priorities donated to it through the locks it holds,
+   moving T within the run queue if it is ready.  Does not
+   preempt the running thread.
+
+   Must be called with interrupts turned off. */
+void
+thread_refresh_priority (struct thread *t) 
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* The idle thread keeps the lowest priority and is never in
+     the ready list, even when it is THREAD_READY. */
+  if (t == idle_thread)
+    return;
+
+  /* There is no donation under the MLFQS scheduler. */
+  for (e = list_begin (&t->locks);
+       !thread_mlfqs && e != list_end (&t->locks); e = list_next (e))
+    {
+      struct lock *l = list_entry (e, struct lock, elem);
+      if (l->priority > priority)
+        priority = l->priority;
+    }
+
+  if (priority == t->priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
 }
 
 /* Returns the current thread's priority. */
@@ -331,35 +459,139 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, recomputes its
+   priority, and yields if a ready thread now has a higher
+   priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *curr = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  curr->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (curr);
+  intr_set_level (old_level);
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level;
+  int load_avg_100;
+
+  old_level = intr_disable ();
+  load_avg_100 = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level;
+  int recent_cpu_100;
+
+  old_level = intr_disable ();
+  recent_cpu_100 = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+
+  return recent_cpu_100;
+}
+
+/* Returns T's MLFQS priority, PRI_MAX - recent_cpu / 4 - nice * 2,
+   clamped to the valid range. */
+static int
+mlfqs_priority (const struct thread *t) 
+{
+  int priority = PRI_MAX - fp_trunc (t->recent_cpu / 4) - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
+/* Recomputes T's MLFQS priority, moving T within the run queue
+   if it is ready.  Must be called with interrupts turned off. */
+static void
+mlfqs_update_priority (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t->base_priority = mlfqs_priority (t);
+  thread_refresh_priority (t);
+}
+
+/* Updates the MLFQS statistics at a timer tick, during which T
+   was running.  Called from the timer interrupt handler. */
+static void
+mlfqs_tick (struct thread *t) 
+{
+  int64_t ticks = timer_ticks ();
+
+  if (t != idle_thread)
+    {
+      t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+      if (!t->cpu_dirty)
+        {
+          t->cpu_dirty = true;
+          list_push_back (&dirty_list, &t->dirty_elem);
+        }
+    }
+
+  if (ticks % TIMER_FREQ == 0)
+    {
+      /* load_avg = (59/60) * load_avg + (1/60) * ready_threads,
+         where the running thread counts as ready. */
+      int ready_threads = ready_cnt + (t != idle_thread);
+      fixed_t decay;
+      struct list_elem *e;
+
+      load_avg = (59 * load_avg + fp_from_int (ready_threads)) / 60;
+
+      /* recent_cpu = (2 * load_avg) / (2 * load_avg + 1)
+                      * recent_cpu + nice, for every thread. */
+      decay = fp_div (2 * load_avg, 2 * load_avg + FP_F);
+      for (e = list_begin (&all_list); e != list_end (&all_list);
+           e = list_next (e))
+        {
+          struct thread *u = list_entry (e, struct thread, allelem);
+          if (u == idle_thread)
+            continue;
+          u->recent_cpu = fp_add_int (fp_mul (decay, u->recent_cpu),
+                                      u->nice);
+          u->cpu_dirty = false;
+          mlfqs_update_priority (u);
+        }
+      list_init (&dirty_list);
+    }
+  else if (ticks % MLFQS_PRIORITY_TICKS == 0)
+    while (!list_empty (&dirty_list))
+      {
+        struct thread *u = list_entry (list_pop_front (&dirty_list),
+                                       struct thread, dirty_elem);
+        u->cpu_dirty = false;
+        mlfqs_update_priority (u);
+      }
+
+  if (ready_max_priority () > t->priority)
+    intr_yield_on_return ();
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -384,6 +616,18 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* While no thread is ready, zero free pages ahead of
+         PAL_ZERO requests, a page at a time. */
+      intr_enable ();
+      while (ready_max_priority () < PRI_MIN && palloc_zero_refill ())
+        continue;
+      intr_disable ();
+      if (ready_max_priority () >= PRI_MIN)
+        continue;
+
+      /* No tick until the next timer is due. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -437,6 +681,8 @@ is_thread (struct thread *t)
 static void
 init_thread (struct thread *t, const char *name, int priority)
 {
+  enum intr_level old_level;
+
   ASSERT (t != NULL);
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
@@ -445,8 +691,25 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  list_init (&t->locks);
+  t->nice = NICE_DEFAULT;
+  t->recent_cpu = 0;
+  if (thread_mlfqs)
+    {
+      /* Inherit from the creating thread, and ignore PRIORITY. */
+      if (t != running_thread ())
+        {
+          t->nice = running_thread ()->nice;
+          t->recent_cpu = running_thread ()->recent_cpu;
+        }
+      priority = mlfqs_priority (t);
+    }
+  t->priority = t->base_priority = priority;
   t->magic = THREAD_MAGIC;
+
+  old_level = intr_disable ();
+  list_push_back (&all_list, &t->allelem);
+  intr_set_level (old_level);
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -462,18 +725,64 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
+/* Adds T to the back of the run queue of its priority. */
+static void
+ready_push (struct thread *t) 
+{
+  int pri = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_list[pri], &t->elem);
+  ready_map[pri / 32] |= 1u << (pri % 32);
+  ready_cnt++;
+}
+
+/* Removes ready thread T from the run queue. */
+static void
+ready_remove (struct thread *t) 
+{
+  int pri = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_list[pri]))
+    ready_map[pri / 32] &= ~(1u << (pri % 32));
+  ready_cnt--;
+}
+
+/* Returns the highest priority of a ready thread, or PRI_MIN - 1
+   if the run queue is empty. */
+static int
+ready_max_priority (void) 
+{
+  int i;
+
+  for (i = DIV_ROUND_UP (PRI_CNT, 32) - 1; i >= 0; i--)
+    if (ready_map[i] != 0)
+      return PRI_MIN + i * 32 + (31 - __builtin_clz (ready_map[i]));
+  return PRI_MIN - 1;
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
+   will be in the run queue.)  The thread chosen is the first of
+   the highest priority.  If the run queue is empty, return
    idle_thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int pri = ready_max_priority () - PRI_MIN;
+  struct thread *t;
+
+  if (pri < 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  t = list_entry (list_front (&ready_list[pri]), struct thread, elem);
+  ready_remove (t);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -24,6 +25,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the MLFQS scheduler. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -87,7 +93,18 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, with donations. */
+    int base_priority;                  /* Priority, without donations. */
+    int nice;                           /* MLFQS niceness. */
+    fixed_t recent_cpu;                 /* MLFQS recent CPU time. */
+    bool cpu_dirty;                     /* recent_cpu changed since
+                                           priority was computed? */
+    struct list_elem dirty_elem;        /* Element in dirty list. */
+    struct list_elem allelem;           /* Element in all threads list. */
+
+    /* Owned by synch.c. */
+    struct list locks;                  /* Locks held. */
+    struct lock *wait_lock;             /* Lock waited for, if any. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
@@ -95,6 +112,7 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct process *process;            /* Process, if a user process. */
 #endif
 
     /* Owned by thread.c. */
@@ -124,9 +142,11 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_refresh_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
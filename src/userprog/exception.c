@@ -179,6 +179,7 @@ page_fault (struct intr_frame *f)
      which fault_addr refers. */
 
   struct thread *curr = thread_current();
+  struct process *p = curr->process;
   //ASSERT(f->esp !=NULL);
   //printf("\n\n page fault \n\n");
   //printf("page fault addr %p, page addr %p, esp %p, pid %d\n", fault_addr, pg_round_down (fault_addr), f->esp, thread_current()->tid);
@@ -186,66 +187,73 @@ page_fault (struct intr_frame *f)
   if(fault_addr == NULL || is_kernel_vaddr(fault_addr))
   {
     //ASSERT(0);
-    find_process(curr -> tid)->exit_status = -1;
+    p->exit_status = -1;
     thread_exit();  
   }
   /* unmapped page */
   else if (pagedir_get_page(curr->pagedir, pg_round_down(fault_addr)) == NULL){
+    /* in the kernel, f->esp is the kernel stack, take the user esp
+       saved at syscall entry */
+    void *esp = user ? f->esp : p->user_esp;
+
     /* ERROR */
-    if(fault_addr == (f->esp)-PGSIZE)
+    if(fault_addr == esp-PGSIZE)
     {
       //ASSERT(0);
-      find_process(curr -> tid)->exit_status = -1;
+      p->exit_status = -1;
       thread_exit();  
     }
 
     /* swap out & lazy loading */
-    else if ( find_s_pte( pg_round_down (fault_addr), curr->tid )!= NULL) {
+    else if ( find_s_pte( pg_round_down (fault_addr), p, write )!= NULL) {
     }
 
 
     /* Stack Growth -  */
-    else if (fault_addr >= f->esp - 32){
+    else if (fault_addr >= esp - 32){
       //printf("PID : %d FAULT ADDRESS %p\n", curr ->tid, pg_round_down(fault_addr));
-      find_process(curr -> tid) -> stack_end = pg_round_down(fault_addr);
+      p -> stack_end = pg_round_down(fault_addr);
       uint8_t *kpage;
       bool writable;
-      kpage = palloc_get_page (PAL_USER | PAL_ZERO);
       //writable = pagedir_is_writable(curr->pagedir, pg_round_down(fault_addr));
       writable = true;
-      if (kpage !=NULL)
-      {
-        /* aaaaaaa pt-grow-stk-sc */
-        
-        //printf("page fault addr %p, page addr %p, esp %p, esp page %p\n", fault_addr, pg_round_down (fault_addr), f->esp, pg_round_down(f->esp));
-        lock_acquire(&evict_lock);
-        pagedir_set_page (thread_current()->pagedir, pg_round_down(fault_addr), kpage, writable, -1);
-        lock_release(&evict_lock);
 
+      /* a read only needs zeros, the frame is taken on the first write */
+      lock_acquire(&p->s_pt_lock);
+      if (!write)
+      {
+        s_pte_map_zero (pg_round_down(fault_addr), p, writable, -1);
       }
       else
       {
-        lock_acquire(&evict_lock);
-        kpage = ptov(get_free_frame());
-        pagedir_set_page (thread_current()->pagedir, pg_round_down(fault_addr), kpage, writable, -1);
-        lock_release(&evict_lock);
+        /* like any other frame : taken through the frame table, 
+           evicting if needed, and mapped into its reverse map */
+        kpage = ptov((uintptr_t) get_free_frame());
+        pagedir_set_page (curr->pagedir, pg_round_down(fault_addr), kpage, writable, -1);
       }
+      lock_release(&p->s_pt_lock);
       //ASSERT(0);
     }
     /* pt-bad-addr */
     else{
       //ASSERT(0);
-      find_process(thread_current() -> tid)->exit_status = -1;
+      p->exit_status = -1;
       thread_exit(); 
     }
       
   }
   
 
+  /* write to a read-only page : copy-on-write after fork.  the page
+     may have been evicted since the check above, s_pte_cow_fault()
+     checks again within the s_pt_lock and lets the write retry */
+  else if (write && s_pte_cow_fault (pg_round_down (fault_addr), p)){
+  }
+
   /* pw-write-code2 */
   else{
  //ASSERT(0);
-    find_process(thread_current() -> tid)->exit_status = -1;
+    p->exit_status = -1;
     thread_exit(); 
     }
 }
@@ -25,8 +25,10 @@ pagedir_create (void)
   return pd;
 }
 
-/* Destroys page directory PD, freeing all the pages it
-   references. */
+/* Destroys page directory PD and its page tables.  The user
+   pages it maps are not freed here: frames may be shared between
+   processes, so they are released through the supplemental page
+   table by free_s_pte_process(). */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -40,11 +42,6 @@ pagedir_destroy (uint32_t *pd)
     if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
-        uint32_t *pte;
-        
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
@@ -119,7 +116,11 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable, int mma
       *pte = pte_create_user (kpage, writable);
       // (new) project3 - make mapping void* va & void * pa
       //printf("pagedir paddr %08x\n", (void*)(((uint32_t)*pte)&PTE_ADDR));
-      s_pte_insert(upage, (uint32_t*)(((uint32_t)*pte)&PTE_ADDR), thread_current()->tid, mmap_id); 
+      if (!s_pte_insert(upage, (uint32_t*)(((uint32_t)*pte)&PTE_ADDR), thread_current()->process, mmap_id))
+        {
+          *pte = 0;
+          return false;
+        }
       return true;
     }
   else{
@@ -205,6 +206,22 @@ pagedir_is_writable (uint32_t *pd, const void *vpage)
   return pte != NULL && (*pte & PTE_W) != 0;
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD.  Used to share a page copy-on-write. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else 
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_pagedir (pd);
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
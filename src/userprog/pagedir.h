@@ -14,6 +14,7 @@ void pagedir_clear_page (uint32_t *pd, void *upage, tid_t);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_writable (uint32_t *pd, const void *vpage);
+void pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
 void pagedir_activate (uint32_t *pd);
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
@@ -31,28 +32,46 @@
 
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static bool fork_files (struct process *parent, struct process *child);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 
 struct list process_list;
 
+/* Guards process_list, and freeing a process in it, against
+   find_process() running in another thread, e.g. a wait on a
+   child that is exiting. */
+static struct lock process_lock;
+
+/* Caches of struct process and of struct fd_file. */
+static struct slab_cache process_cache;
+struct slab_cache fd_file_cache;
+
 void
 process_init (void)
 {
   list_init(&process_list);
+  lock_init(&process_lock);
+  slab_cache_init(&process_cache, "process", sizeof (struct process), NULL);
+  slab_cache_init(&fd_file_cache, "fd_file", sizeof (struct fd_file), NULL);
 
   struct process *initial_process;
-  initial_process = malloc(sizeof *initial_process);
+  initial_process = slab_alloc(&process_cache);
   initial_process -> pid = thread_current() -> tid;
   initial_process -> is_dead = false;
   initial_process -> load_success = false;
   initial_process -> fd_cnt = 2;
   initial_process -> thread = thread_current();
+  thread_current() -> process = initial_process;
   list_init(&initial_process -> file_list);
   list_init(&initial_process -> children_pids);
   list_init(&initial_process -> mapping_list);
   list_init(&initial_process -> load_file_table);
+  s_page_table_init(initial_process);
+  lock_acquire(&process_lock);
   list_push_back(&process_list, &initial_process->elem);
+  lock_release(&process_lock);
 
 }
 /* Starts a new thread running a user program loaded from
@@ -91,7 +110,7 @@ process_execute (const char *file_name)
 
 
   struct process *child;
-  child = malloc(sizeof *child);   
+  child = slab_alloc(&process_cache);   
   child->parent_pid = thread_current()->tid;
   list_init(&child->children_pids);
   child->is_dead = false;
@@ -99,10 +118,13 @@ process_execute (const char *file_name)
   list_init(&child->file_list);
   list_init(&child -> mapping_list);
   list_init(&child -> load_file_table);
+  s_page_table_init(child);
 
   child->fd_cnt = 2;
   
+  lock_acquire(&process_lock);
   list_push_back(&process_list, &child->elem);
+  lock_release(&process_lock);
   /* Create a new thread to execute FILE_NAME. */
   tid = thread_create (t_name, PRI_DEFAULT, start_process, fn_copy);
     child->pid = tid;
@@ -111,8 +133,11 @@ process_execute (const char *file_name)
     palloc_free_page (fn_copy); 
     palloc_free_page (file_name_copy);
     free(t_name);
+    lock_acquire(&process_lock);
     list_remove(&child->elem);
-    free(child);
+    lock_release(&process_lock);
+    hash_destroy(&child->s_page_table, NULL);
+    slab_free(&process_cache, child);
   }
   //2. If thread_create(child) success -> add to process_list
   else{
@@ -123,8 +148,10 @@ process_execute (const char *file_name)
 
     //4. If load(child) !success -> remove from process_list
     if(!child->load_success){
+      lock_acquire(&process_lock);
       list_remove(&child->elem);
-      free(child);
+      slab_free(&process_cache, child);
+      lock_release(&process_lock);
       tid = -1;
     }
     //5. If load(child) success -> push it to curr_p's children_pids list
@@ -149,6 +176,7 @@ start_process (void *f_name)
   curr_p = find_process(thread_current()->tid);
   ASSERT(curr_p != NULL);
   curr_p-> thread = thread_current();
+  thread_current()->process = curr_p;
 
   char *file_name = f_name;
   struct intr_frame if_;
@@ -247,6 +275,170 @@ start_process (void *f_name)
   NOT_REACHED ();
 }
 
+/* What start_fork() needs to build the child: both processes and
+   the user context of the parent at the fork system call. */
+struct fork_args
+  {
+    struct process *parent;
+    struct process *child;
+    struct intr_frame if_;
+  };
+
+/* Creates a child process that is a copy of the current one,
+   resuming from the fork system call whose user context is F.
+   The address space is shared copy-on-write and mmaps are not
+   inherited.  Returns the child's thread id, or TID_ERROR if the
+   child cannot be created. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct process *curr_p;
+  struct process *child;
+  struct fork_args *args;
+  struct childpid_elem *child_elem;
+  tid_t tid;
+
+  curr_p = find_process(thread_current()->tid);
+  sema_init(&curr_p->sema_pexec, 0);
+  sema_init(&curr_p->sema_pwait, 0);
+
+  args = malloc (sizeof *args);
+  child = slab_alloc (&process_cache);
+  child_elem = malloc (sizeof *child_elem);
+  if (args == NULL || child == NULL || child_elem == NULL)
+    {
+      free (args);
+      slab_free (&process_cache, child);
+      free (child_elem);
+      return TID_ERROR;
+    }
+
+  child->parent_pid = curr_p->pid;
+  list_init(&child->children_pids);
+  child->is_dead = false;
+  child->load_success = false;
+  child->exit_status = 0;
+  list_init(&child->file_list);
+  list_init(&child -> mapping_list);
+  list_init(&child -> load_file_table);
+  s_page_table_init(child);
+  child->fd_cnt = curr_p->fd_cnt;
+  child->exec_file = NULL;
+  child->stack_start = curr_p->stack_start;
+  child->stack_end = curr_p->stack_end;
+  child->first_load = curr_p->first_load;
+
+  lock_acquire(&process_lock);
+  list_push_back(&process_list, &child->elem);
+  lock_release(&process_lock);
+  args->parent = curr_p;
+  args->child = child;
+  args->if_ = *f;
+  tid = thread_create (thread_name (), PRI_DEFAULT, start_fork, args);
+  if (tid == TID_ERROR)
+    {
+      lock_acquire(&process_lock);
+      list_remove(&child->elem);
+      lock_release(&process_lock);
+      hash_destroy(&child->s_page_table, NULL);
+      slab_free (&process_cache, child);
+      free (child_elem);
+      free (args);
+      return TID_ERROR;
+    }
+  child->pid = tid;
+
+  /* Wait until the child has copied this process.  A child that
+     failed still exits on its own, so it is kept as a child and
+     freed like any other one. */
+  sema_down(&curr_p->sema_pexec);
+  child_elem->childpid = tid;
+  list_push_back(&curr_p->children_pids, &child_elem->elem);
+  return child->load_success ? tid : TID_ERROR;
+}
+
+/* A thread function that builds a forked child from the parent
+   waiting in process_fork() and makes it return 0 from fork. */
+static void
+start_fork (void *args_)
+{
+  struct fork_args *args = args_;
+  struct process *parent = args->parent;
+  struct process *curr_p = args->child;
+  struct thread *t = thread_current ();
+  struct intr_frame if_ = args->if_;
+  bool success;
+
+  free (args);
+  curr_p->pid = t->tid;
+  curr_p->thread = t;
+  t->process = curr_p;
+
+  t->pagedir = pagedir_create ();
+  success = t->pagedir != NULL;
+  if (success)
+    {
+      process_activate ();
+      success = fork_files (parent, curr_p)
+                && s_page_table_fork (parent, curr_p);
+    }
+
+  curr_p->load_success = success;
+  sema_up(&parent->sema_pexec);
+  if (!success)
+    sys_exit (-1);
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives CHILD its own handle, at the same position, on every file
+   PARENT has open and on PARENT's executable, and copies the exec
+   file table that lazy loading reads from. */
+static bool
+fork_files (struct process *parent, struct process *child)
+{
+  struct list_elem *e;
+  bool success = true;
+
+  lock_acquire(&filesys_lock);
+  for (e = list_begin(&parent->file_list); e != list_end(&parent->file_list);
+       e = list_next(e))
+    {
+      struct fd_file *pf = list_entry(e, struct fd_file, elem);
+      struct fd_file *cf = slab_alloc (&fd_file_cache);
+
+      if (cf == NULL || (cf->file = file_reopen (pf->file)) == NULL)
+        {
+          slab_free (&fd_file_cache, cf);
+          success = false;
+          break;
+        }
+      file_seek (cf->file, file_tell (pf->file));
+      cf->fd = pf->fd;
+      list_push_back(&child->file_list, &cf->elem);
+    }
+  if (success && parent->exec_file != NULL)
+    {
+      child->exec_file = file_reopen (parent->exec_file);
+      if (child->exec_file != NULL)
+        file_deny_write (child->exec_file);
+      else
+        success = false;
+    }
+  lock_release(&filesys_lock);
+
+  for (e = list_begin(&parent->load_file_table);
+       e != list_end(&parent->load_file_table); e = list_next(e))
+    {
+      struct fte *fte = list_entry(e, struct fte, elem);
+      file_insert(&child->load_file_table, fte->vaddr, fte->ofs, fte->size,
+                  fte->writable);
+    }
+  return success;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -278,24 +470,24 @@ process_wait (tid_t child_tid)
     ASSERT(child_p != NULL);
     if (child_p->is_dead){
       int exit_status = get_exitstatus(child_tid);
-      lock_acquire(&evict_lock);
+      lock_acquire(&process_lock);
       //printf("free process %d\n", child_tid);
 
       list_remove(&child_p->elem);
-      free(child_p);
-      lock_release(&evict_lock);
+      slab_free(&process_cache, child_p);
+      lock_release(&process_lock);
       return exit_status;
     }
     //CASE 2: child is not dead -> wait for child to exit
     else{
       sema_down(&curr_p->sema_pwait);
       int exit_status = get_exitstatus(child_tid);
-      lock_acquire(&evict_lock);
+      lock_acquire(&process_lock);
       //printf("free process %d\n", child_tid);
 
       list_remove(&child_p->elem);
-      free(child_p);
-      lock_release(&evict_lock);
+      slab_free(&process_cache, child_p);
+      lock_release(&process_lock);
       return exit_status;
     }
   } 
@@ -321,13 +513,14 @@ process_exit (void)
       struct list_elem *e;
       for(e = list_begin(&curr_p->mapping_list); e != list_end(&curr_p->mapping_list); e= list_next(e)){
         struct mapping *m = list_entry(e, struct mapping, elem);
-        is_written(&m->file_table, m->fd);
+        if (m->file != NULL)
+          sync_mapping(&m->file_table, m->file);
       }
     }
     printf("%s: exit(%d)\n", thread_name(), curr_p->exit_status);
 
 //FREE: FREE (is_dead)ychildren's process structure & remove from process_list
-    lock_acquire(&evict_lock);
+    lock_acquire(&process_lock);
     if (!list_empty(&curr_p -> children_pids)){
       struct list_elem *e;
       struct childpid_elem *child_elem;
@@ -343,12 +536,12 @@ process_exit (void)
           //printf("free process %d\n",child_p->pid);
           
           list_remove(&child_p->elem);
-          free(child_p);
+          slab_free(&process_cache, child_p);
           
         }
       }
     }
-    lock_release(&evict_lock);
+    lock_release(&process_lock);
 
 
 
@@ -360,7 +553,7 @@ process_exit (void)
       struct list_elem *e = list_pop_front (&curr_p->file_list);
       fd_file = list_entry(e, struct fd_file, elem);
       free(fd_file->file);
-      free(fd_file);
+      slab_free(&fd_file_cache, fd_file);
     }
 
     //FREE: FREE 'childpid_elem'
@@ -372,34 +565,12 @@ process_exit (void)
       free(childpid);
     }
 
-    //FREE: FREE 'exec_file'
-    if(curr_p->exec_file !=NULL){
-        file_close (curr_p->exec_file);
-        curr_p->exec_file = NULL;
-    }
-
-
-    //CASE 0: NO Parent
-    if (parent_p == NULL){
-      //printf("free process %d\n",curr_p->pid);
-      lock_acquire(&evict_lock);
-      list_remove(&curr_p->elem);
-      free(curr_p);
-      lock_release(&evict_lock);
-    }
-    //CASE 1: Parent already dead
-    else if (parent_p->is_dead == true){
-      //printf("free process %d\n",curr_p->pid);
-      lock_acquire(&evict_lock);
-      list_remove(&curr_p->elem);
-      free(curr_p);
-      lock_release(&evict_lock);
-    }    
 
     uint32_t *pd;
   /* Destroy the current process's page directory and switch back
-     to the kernel-only page directory. */
-    lock_acquire(&evict_lock);
+     to the kernel-only page directory.  Within the s_pt_lock, no
+     eviction is looking at the page directory or the pages. */
+    lock_acquire(&curr_p->s_pt_lock);
 
   pd = curr->pagedir;
   if (pd != NULL) 
@@ -421,18 +592,41 @@ process_exit (void)
   }
 
 
-        curr_p -> is_dead = true;
+    //process_free_frame(curr->tid);
+    free_s_pte_process(curr_p);
 
+    lock_release(&curr_p->s_pt_lock);
 
-    
-    //process_free_frame(curr->tid);
-    free_swap_slot_process(curr->tid);
-    free_frame_process(curr->tid);
-    free_s_pte_process(curr->tid);
+        curr_p -> is_dead = true;
+    /* curr_p may be freed below, or by the parent at any time */
+    curr->process = NULL;
+
+    //FREE: FREE 'exec_file'
+    /* after the frames are released, a shared frame is keyed by 
+       the inode of this file */
+    if(curr_p->exec_file !=NULL){
+        file_close (curr_p->exec_file);
+        curr_p->exec_file = NULL;
+    }
 
-    lock_release(&evict_lock);
+    /* The supplemental page table lives in curr_p, so curr_p is
+       freed only after the tables above are torn down. */
+    //CASE 0: NO Parent
+    if (parent_p == NULL){
+      lock_acquire(&process_lock);
+      list_remove(&curr_p->elem);
+      slab_free(&process_cache, curr_p);
+      lock_release(&process_lock);
+    }
+    //CASE 1: Parent already dead
+    else if (parent_p->is_dead == true){
+      lock_acquire(&process_lock);
+      list_remove(&curr_p->elem);
+      slab_free(&process_cache, curr_p);
+      lock_release(&process_lock);
+    }    
     //CASE 2: parent is waiting for exit
-    if(!list_empty(&parent_p->sema_pwait.waiters) )
+    else if(!list_empty(&parent_p->sema_pwait.waiters) )
       sema_up(&parent_p->sema_pwait);
 
   
@@ -760,26 +954,16 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
       
-      //Get a page of memory. 
+      /* Nothing is read here, the page is loaded by find_s_pte()
+         on its first fault.  A page without file data is mapped
+         to the shared zero frame until it is written. */
       //printf("vaddr : %p\n", upage);
-      uint8_t *kpage = palloc_get_page (0);
-      s_pte_insert(upage, NULL, thread_current()->tid, 0);
+      if (!s_pte_insert(upage, NULL, p, 0))
+        return false;
       file_insert(&p->load_file_table, upage, ofs, page_read_bytes, writable);
-       if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
-        {
-                    ASSERT(0);
-
-          palloc_free_page (kpage);
-          return false; 
-        }
-      memset (kpage + page_read_bytes, 0, page_zero_bytes);
-
-      palloc_free_page(kpage);
 /*
       if (kpage == NULL){
-        lock_acquire(&evict_lock);
         kpage = ptov((uint32_t)get_free_frame());
-        lock_release(&evict_lock);
         //printf("paddr %p\n", kpage);
 //return false;
       }
@@ -824,11 +1008,8 @@ setup_stack (void **esp)
   bool success = false;
 
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (kpage == NULL){
-    lock_acquire(&evict_lock);
+  if (kpage == NULL)
     kpage = ptov((uint32_t)get_free_frame());
-    lock_release(&evict_lock);
-  }
   if (kpage != NULL) 
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
@@ -877,21 +1058,22 @@ find_processelem(tid_t pid){
   return e;
 }
 
+/* Returns the process of PID, or a null pointer if there is none.
+   process_lock is taken unless the caller holds it already. */
 struct process *
 find_process(tid_t pid){
-  struct process *p;
+  struct process *p = NULL;
   struct list_elem *e;
-  if (list_empty(&process_list))
-    return NULL;
-  e = find_processelem(pid);
+  bool held = lock_held_by_current_thread (&process_lock);
 
-  if (e == list_end(&process_list)){    //there's no pid process in process list
-    return NULL;
-  }
-  else{
+  if (!held)
+    lock_acquire (&process_lock);
+  e = find_processelem(pid);
+  if (e != list_end(&process_list))    //there's no pid process in process list
     p = list_entry(e, struct process, elem);
+  if (!held)
+    lock_release (&process_lock);
   return p;
-  } 
 }
 
 struct list_elem *
@@ -3,8 +3,11 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include "threads/interrupt.h"
+#include <hash.h>
 #include <list.h>
 #include "threads/synch.h"
+#include "threads/slab.h"
 
 struct fd_file
 {
@@ -13,6 +16,9 @@ struct fd_file
 	struct list_elem elem;
 };
 
+/* Cache of struct fd_file, one per open file descriptor */
+extern struct slab_cache fd_file_cache;
+
 /* process의 childeren_pids에 저장해 주기 위한 struct 
 이 역시 load success한 child만 저장 */
 struct childpid_elem
@@ -43,8 +49,13 @@ struct process
 	struct list file_list;			/* 이 process가 open 한 file_list */
 	struct list load_file_table;			/* Manage exec file of this process */
 	struct list mapping_list;		/* Manage mmap memory */
+	struct hash s_page_table;		/* Supplemental page table of this process */
+	struct lock s_pt_lock;			/* Protects s_page_table */
+	void * fault_next;				/* page right after the last fault-around window */
+	size_t fault_window;			/* current fault-around window, in pages */
 	void * stack_end;				/* Point end of stack */
 	void * stack_start;				/* Point end of stack */
+	void * user_esp;				/* user esp at syscall entry, for faults in the kernel */
 
 	bool first_load;
 	struct list_elem elem;
@@ -52,6 +63,7 @@ struct process
 
 void process_init (void);
 tid_t process_execute (const char *file_name);
+tid_t process_fork (struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -5,6 +5,7 @@
 #include "threads/thread.h"
 #include "userprog/process.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/init.h"
 #include "threads/vaddr.h"
 #include <string.h>
@@ -21,6 +22,10 @@
 
 
 static void syscall_handler (struct intr_frame *);
+
+/* Serializes the file system, which is not thread safe.  Page
+   faults and eviction take it within an s_pt_lock, so nothing may
+   fault while holding it : user buffers are pinned before. */
 struct lock filesys_lock;
 
 void
@@ -39,6 +44,8 @@ syscall_handler (struct intr_frame *f)
   if(!is_valid_usraddr(sp)){
   	sys_exit(-1);
   }
+  /* a fault on a user buffer in the kernel grows the stack from here */
+  thread_current()->process->user_esp = sp;
 
   switch (*sp) {
     case SYS_HALT :
@@ -114,10 +121,93 @@ syscall_handler (struct intr_frame *f)
       syscall_arguments(argv, sp, 1);
       sys_munmap((int)*argv[0]);
       break;
+
+    case SYS_FORK :
+      f->eax = sys_fork(f);
+      break;
+
+    case SYS_MSYNC :
+      syscall_arguments(argv, sp, 1);
+      sys_msync((int)*argv[0]);
+      break;
   }
 }
 
 
+/* access user page UPAGE from the kernel, a write if WRITE, so that
+   the page fault handler brings it in as for the user */
+static void
+touch_user_page (uint8_t *upage, bool write)
+{
+  volatile uint8_t *b = upage;
+
+  if (write)
+    *b = *b;
+  else
+    (void) *b;
+}
+
+/* fault in every page of the user buffer [BUFFER, BUFFER + SIZE) 
+   and pin its frame, so the kernel reads or writes the user frames
+   directly and no page is evicted before unpin_user_buffer().
+   WRITE : the kernel writes into the buffer, so every page is made
+   writable (copy-on-write pages are copied).  a bad buffer kills 
+   the process here, before anything is pinned or locked. */
+static void
+pin_user_buffer (const void *buffer, unsigned size, bool write)
+{
+  struct thread *t = thread_current ();
+  struct process *p = t->process;
+  uint8_t *start = pg_round_down (buffer);
+  uint8_t *end = (uint8_t *) buffer + size;
+  uint8_t *upage;
+
+  if (size == 0)
+    return;
+  if (!is_user_vaddr (buffer) || end <= (uint8_t *) buffer 
+      || !is_user_vaddr (end - 1))
+    sys_exit (-1);
+
+  /* touch every page first : the fault handler loads it, grows the
+     stack, or kills the process */
+  for (upage = start; upage < end; upage += PGSIZE)
+    touch_user_page (upage, write);
+
+  /* within the s_pt_lock no eviction is working on a present page,
+     so it stays until pinned.  one evicted since it was touched is
+     touched again */
+  for (upage = start; upage < end; upage += PGSIZE)
+    for (;;)
+      {
+        void *kpage;
+        bool ok;
+
+        lock_acquire (&p->s_pt_lock);
+        kpage = pagedir_get_page (t->pagedir, upage);
+        ok = kpage != NULL && (!write || pagedir_is_writable (t->pagedir, upage));
+        if (ok)
+          frame_set_pinned ((void *) vtop (kpage), true);
+        lock_release (&p->s_pt_lock);
+        if (ok)
+          break;
+        touch_user_page (upage, write);
+      }
+}
+
+/* unpin the frames pin_user_buffer() pinned for [BUFFER, BUFFER + SIZE) */
+static void
+unpin_user_buffer (const void *buffer, unsigned size)
+{
+  struct thread *t = thread_current ();
+  uint8_t *end = (uint8_t *) buffer + size;
+  uint8_t *upage;
+
+  if (size == 0)
+    return;
+  for (upage = pg_round_down (buffer); upage < end; upage += PGSIZE)
+    frame_set_pinned ((void *) vtop (pagedir_get_page (t->pagedir, upage)), false);
+}
+
 void
 syscall_arguments(uint32_t **argv, uint32_t *sp, int argc) {
   int i;
@@ -152,6 +242,12 @@ sys_exec(const char *cmd_line)
     return process_execute(cmd_line);
 }
 
+int
+sys_fork(struct intr_frame *f)
+{
+  return process_fork(f);
+}
+
 int
 sys_wait(tid_t pid)
 {
@@ -188,10 +284,13 @@ sys_open(const char *file)
   int fd;
   struct file * f;
   struct process * p;
-  p = find_process(thread_current()->tid);
+  unsigned len = strlen (file) + 1;
+  p = thread_current()->process;
+  pin_user_buffer(file, len, false);
   lock_acquire(&filesys_lock);
   f = filesys_open (file);
 lock_release(&filesys_lock);
+  unpin_user_buffer(file, len);
   //ERROR: file is NULL
   if(f == NULL){
     fd = -1;
@@ -203,7 +302,7 @@ lock_release(&filesys_lock);
     p->fd_cnt++;
 
     struct fd_file *fd_and_file;
-    fd_and_file = malloc (sizeof *fd_and_file); 
+    fd_and_file = slab_alloc (&fd_file_cache);
 
     fd_and_file->fd = fd;
     fd_and_file->file = f;
@@ -232,31 +331,32 @@ sys_read(int fd, const void *buffer, unsigned size)
   if (fd == 1){
     sys_exit(-1);
   }
+  //ERROR: NO FILE!
+  if (fd != 0 && find_file(fd) == NULL){
+    sys_exit(-1);
+  }
+
+  /* the file system writes straight into the user frames */
+  pin_user_buffer(buffer, size, true);
 
   //Filesys synchronization
   lock_acquire(&filesys_lock);
 
   //CASE 1: READ from command
   if(fd == 0){
+    uint8_t *p = (uint8_t *) buffer;
     int i;
-    for (i = 0; i !=(int)size; i++){
-      *(uint8_t *)buffer = input_getc();
-      buffer++;
-    }
-    lock_release(&filesys_lock);
-    return size;
+    for (i = 0; i !=(int)size; i++)
+      p[i] = input_getc();
+    result = size;
   }
   //CASE 2: READ from file
   else{
-    //ERROR: NO FILE!
-    if (find_file(fd) == NULL){
-      lock_release(&filesys_lock);
-      sys_exit(-1);
-    }
     f = find_file(fd)->file;
     result = file_read(f, buffer, (off_t) size);
-    lock_release(&filesys_lock);
   }
+  lock_release(&filesys_lock);
+  unpin_user_buffer(buffer, size);
   return result;
 }
 
@@ -266,13 +366,19 @@ sys_write(int fd, const void *buffer, unsigned size)
   struct file *f;
 
   //CASE 0: buffer's address is NOT available
-  if(!is_valid_usraddr((void *)buffer) || !is_user_vaddr (buffer + size)){
+  if((void *)buffer == NULL){
     sys_exit(-1);
   }
   //CASE 0: fd == 0 is read to command
   if (fd == 0){
     sys_exit(-1);
   }
+  if (fd != 1 && find_file(fd) == NULL){
+    sys_exit(-1);
+  }
+
+  /* the file system reads straight from the user frames */
+  pin_user_buffer(buffer, size, false);
 
   lock_acquire(&filesys_lock);
   int result;
@@ -284,15 +390,11 @@ sys_write(int fd, const void *buffer, unsigned size)
   }
   //CASE 2: WRITE to file
   else{
-    if (find_file(fd) == NULL){
-      lock_release(&filesys_lock);
-      sys_exit(-1);
-    }
-    
     f = find_file(fd)->file;
     result = file_write(f, buffer, (off_t) size);
   }
   lock_release(&filesys_lock);
+  unpin_user_buffer(buffer, size);
 
   return result;
 }
@@ -343,19 +445,18 @@ sys_close(int fd)
   if (find_file(fd) == NULL){
     sys_exit(-1);
   }
-  struct file *f = find_file(fd)->file;
+  struct fd_file *fd_file = find_file(fd);
+  struct file *f = fd_file->file;
   
+  /* once removed, find_file() no longer finds it */
+  list_remove(&fd_file->elem);
+  slab_free(&fd_file_cache, fd_file);
+
   //ERROR: FILE is NULL
-  if (f == NULL){
-    list_remove(&find_file(fd)->elem);
-    free(find_file(fd));
+  if (f == NULL)
     sys_exit(-1);
-  }
-  else{
+  else
     file_close (f);
-    list_remove(&find_file(fd)->elem);
-    free(find_file(fd));
-  }
 }
 
 
@@ -397,7 +498,7 @@ sys_mmap(int fd, void *upage)
   }
   /* if range 가 existing set of mapped pages 라면 (executable도 포함)
   */
-  struct process * p = find_process(thread_current()->tid);
+  struct process * p = thread_current()->process;
   if (find_mapping_vaddr(&p->mapping_list, upage) != NULL){
     return -1;
   }
@@ -439,7 +540,11 @@ sys_mmap(int fd, void *upage)
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
       
       uint8_t *kpage = palloc_get_page (0);
-      s_pte_insert(upage, NULL, thread_current()->tid, m->id);
+      if (!s_pte_insert(upage, NULL, p, m->id))
+        {
+          palloc_free_page (kpage);
+          return -1;
+        }
       file_insert(&m->file_table, upage, ofs, page_read_bytes, writable);
        if (file_read (m->file, kpage, page_read_bytes) != (int) page_read_bytes)
         {
@@ -468,19 +573,32 @@ void
 sys_munmap(int mapping)
 {
   
-  struct process * p = find_process(thread_current()->tid);
+  struct process * p = thread_current()->process;
   struct mapping * m = find_mapping_id(&p->mapping_list, (int)mapping);
-  if(m == NULL){
+  if(m == NULL || m->file == NULL){
     sys_exit(-1);
   }
   //printf("mummap : id %d\n", mapping);
-  //lock_acquire(&filesys_lock);
-  is_written(&m->file_table, m->fd);
-  file_close(m->file);
-  //lock_release(&filesys_lock);
+  sync_mapping(&m->file_table, m->file);
   free_mapping(&m->file_table);
+  file_close(m->file);
+  /* the mapping stays in the list as unmapped, ids are never reused */
+  m->file = NULL;
   //list_remove(&m->elem);
   //free(m);
 
 }
 
+/* write the modified pages of a mapping back to its file, 
+   the mapping stays */
+void
+sys_msync(int mapping)
+{
+  struct process * p = thread_current()->process;
+  struct mapping * m = find_mapping_id(&p->mapping_list, mapping);
+  if(m == NULL || m->file == NULL){
+    sys_exit(-1);
+  }
+  sync_mapping(&m->file_table, m->file);
+}
+
@@ -3,12 +3,14 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "threads/thread.h"
+#include "threads/interrupt.h"
 
 void syscall_init (void);
 void syscall_arguments(uint32_t **, uint32_t *, int);
 void sys_halt (void);
 void sys_exit (int);
 int sys_exec(const char *);
+int sys_fork(struct intr_frame *);
 int sys_wait(tid_t);
 bool sys_create(const char *, unsigned);
 bool sys_remove(const char *);
@@ -21,6 +23,7 @@ unsigned sys_tell(int);
 void sys_close(int);
 int sys_mmap(int, void *);
 void  sys_munmap(int mapping);
+void sys_msync(int mapping);
 struct lock filesys_lock;
 
 #endif /* userprog/syscall.h */
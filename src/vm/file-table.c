@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <list.h>
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "vm/s-pagetable.h"
 #include "vm/frame.h"
 #include "userprog/pagedir.h"
@@ -10,13 +11,21 @@
 #include "filesys/file.h"
 #include "threads/vaddr.h"
 
+/* cache every fte is allocated from */
+static struct slab_cache fte_cache;
 
+/* init the fte cache */
+void
+file_table_init(void)
+{
+	slab_cache_init(&fte_cache, "fte", sizeof (struct fte), NULL);
+}
 
 void
 file_insert(struct list *file_table, void * vaddr, off_t ofs, uint32_t size, bool writable){
 	//printf("file_insert : vaddr : %p, ofs : %d, size : %d, writable : %d\n", vaddr, ofs, size, writable);
 	struct fte *fte;
-	fte = malloc(sizeof *fte);
+	fte = slab_alloc(&fte_cache);
 	
 	fte -> vaddr = vaddr;
 	fte -> ofs = ofs;
@@ -46,36 +55,85 @@ free_mapping(struct list * file_table)
 	struct list_elem *e;
 	struct fte *fte; 
 	struct thread * t = thread_current();
+	struct process *p = t->process;
+
+	/* within the s_pt_lock, a page is not evicted under our feet.
+		every page leaves the s_pt too, resident or not, so that an 
+		access after munmap is a plain bad access */
+	lock_acquire(&p->s_pt_lock);
 	for(e = list_begin(file_table); e != list_end(file_table); e= list_next(e)){
 		fte = list_entry(e, struct fte, elem);
-		uint32_t kpage = ptov(frame_lookup_vaddr(fte->vaddr, t->tid)->paddr);
-		free_frame_entry(fte->vaddr, t->tid);
-		s_pte_clear(fte->vaddr, t->tid); 
+		void *kpage = pagedir_get_page(t->pagedir, fte->vaddr);
+		if (kpage == NULL){
+			s_pte_remove(fte->vaddr, p);
+			continue;
+		}
+		struct s_pte *pte;
+		pte = find_entry(fte->vaddr, p);
+		bool unused = free_frame_entry(pte);
+		s_pte_clear(fte->vaddr, p); 
 		pagedir_clear_page (t->pagedir, fte->vaddr, t->tid);
 
-		palloc_free_page(kpage);
-
+		if (unused)
+			palloc_free_page(kpage);
+		s_pte_remove(fte->vaddr, p);
 	}
+	lock_release(&p->s_pt_lock);
 }
 
+/*
+	write the dirty resident pages of a mapping back to file.
+	from munmap, msync and process exit
+
+	1. a run of dirty pages that follow each other both in memory and 
+		in the file goes out in one write, straight from the user 
+		addresses, which are contiguous even though the frames are not.
+	2. the pages are clean afterwards, so a page is written again only
+		once it is modified again.
+	3. it runs within the s_pt_lock, no page is evicted meanwhile,
+		so the writes from user addresses never fault.
+	4. the file system is not thread safe, so each coalesced write
+		takes filesys_lock, like eviction write-back.  the lock is 
+		held for the writes only, never while the mapping is walked.
+*/
 void
-is_written(struct list * file_table, int fd)
+sync_mapping(struct list *file_table, struct file *file)
 {
 	struct list_elem *e;
-	struct fte *fte; 
-	struct thread * t = thread_current();
-	lock_acquire(&filesys_lock);
-	if(find_file(fd) != NULL){
-		for(e = list_begin(file_table); e != list_end(file_table); e= list_next(e)){
-			fte = list_entry(e, struct fte, elem);
-			if(pagedir_is_dirty (t->pagedir, fte->vaddr)){
-				//printf("file_insert : vaddr : %p, ofs : %d, size : %d, writable : %d\n", fte->vaddr, fte->ofs, fte->size, fte->writable);
-				file_write_at(find_file(fd)->file, fte->vaddr, fte->size, fte->ofs);
-			}
+	struct thread *t = thread_current();
+	struct process *p = t->process;
+	struct fte *run = NULL;			/* first page of the pending run */
+	uint32_t run_size = 0;
+
+	lock_acquire(&p->s_pt_lock);
+	for(e = list_begin(file_table); e != list_end(file_table); e= list_next(e)){
+		struct fte *fte = list_entry(e, struct fte, elem);
+		bool dirty = pagedir_get_page(t->pagedir, fte->vaddr) != NULL
+			&& pagedir_is_dirty(t->pagedir, fte->vaddr);
+
+		if (run != NULL && (!dirty 
+		    || fte->vaddr != (uint8_t *) run->vaddr + run_size
+		    || fte->ofs != run->ofs + (off_t) run_size)){
+			lock_acquire(&filesys_lock);
+			file_write_at(file, run->vaddr, run_size, run->ofs);
+			lock_release(&filesys_lock);
+			run = NULL;
 		}
+		if (!dirty)
+			continue;
+		if (run == NULL){
+			run = fte;
+			run_size = 0;
+		}
+		run_size += fte->size;
+		pagedir_set_dirty(t->pagedir, fte->vaddr, false);
 	}
-	lock_release(&filesys_lock);
-
+	if (run != NULL){
+		lock_acquire(&filesys_lock);
+		file_write_at(file, run->vaddr, run_size, run->ofs);
+		lock_release(&filesys_lock);
+	}
+	lock_release(&p->s_pt_lock);
 }
 
 bool is_valid_mapping_load(struct list* file_table, void * addr)
@@ -3,6 +3,8 @@
 #include <list.h>
 #include <stdint.h>
 
+struct file;
+
 struct fte {
 	struct list_elem elem;			/* List element */
 	void * vaddr;					/* virtual address */
@@ -12,10 +14,11 @@ struct fte {
 };
 
 
+void file_table_init(void);
 void free_mapping(struct list *);
 
 
-void is_written(struct list * , int);
+void sync_mapping(struct list *, struct file *);
 void file_insert(struct list *, void *, off_t, uint32_t, bool);
 struct fte * find_fte(struct list *, void *);
 bool is_valid_mapping_load(struct list *, void *);
@@ -4,215 +4,684 @@
 #include "threads/palloc.h"
 #include "userprog/syscall.h"
 #include <hash.h>
+#include <stdint.h>
+#include <string.h>
 #include "threads/vaddr.h"
 #include "vm/s-pagetable.h"
 #include "userprog/process.h"
 #include "vm/swap.h"
+#include "vm/file-table.h"
+#include "vm/mmap-table.h"
+#include "filesys/file.h"
+#include "devices/timer.h"
+#include <list.h>
 
 
-struct list frame_table;
+/* Descriptor array indexed by palloc_frame_idx(), and the
+   share table of read-only exec pages, keyed by (inode, ofs). */
+static struct frame *frame_table;
+static size_t frame_cnt;
+static struct hash share_table;
+
+/* read-only frame of zeros mapped by every page that has no data 
+	yet.  it comes from the kernel pool, so it has no descriptor */
+static void *zero_frame;
 struct lock frame_lock;
-struct lock evict_lock;
 
-/* init frame table, each entry would be inserted or replaced 
-	when s_page_table entry added */
+/* get_free_frame() waits on frame_cond, within frame_lock, when no
+	frame is free and none can be evicted.  frame_event counts the 
+	times a frame may have become available since */
+static struct condition frame_cond;
+static unsigned frame_event;
+
+/* page-out daemon watermarks, in pages free for user pages 
+	(palloc_user_free_cnt()) */
+#define PAGEOUT_LOW_MIN 8
+
+/* ticks the page-out daemon waits before it tries again, when it
+	stopped short of pageout_high because no frame could be evicted */
+#define PAGEOUT_RETRY_TICKS 4
+
+static size_t pageout_low;
+static size_t pageout_high;
+static struct semaphore pageout_sema;
+static struct timer pageout_timer;
+
+static void *evict_frame (void);
+static void frame_available (void);
+static void evict_shared_frame (struct frame *);
+static bool frame_lock_owners (struct frame *, bool *);
+static void frame_unlock_owners (struct frame *, struct list_elem *, bool);
+static size_t swap_cluster_collect (struct process *, void *, void **,
+                                    struct s_pte **, size_t);
+static void pageout_daemon (void *);
+static void pageout_wake (void *);
+static void mmap_write_back (struct process *, int, void *, void *);
+static unsigned share_hash (const struct hash_elem *, void * UNUSED);
+static bool share_less (const struct hash_elem *, const struct hash_elem *, void * UNUSED);
+
+/* init frame table, one descriptor for every page that can hold a 
+	user page : the user pool, and the kernel pool that lends pages
+	to it.  each entry would be filled or replaced when s_page_table 
+	entry added */
 void 
 frametable_init(void)
 {	
-	list_init(&frame_table);
+	size_t i;
+
+	frame_cnt = palloc_frame_cnt();
+	frame_table = calloc(frame_cnt, sizeof *frame_table);
+	if (frame_table == NULL)
+		PANIC ("couldn't allocate frame table");
+	for (i = 0; i < frame_cnt; i++){
+		frame_table[i].paddr = (void *) vtop(palloc_frame_page(i));
+		list_init(&frame_table[i].rmap);
+	}
+
+	hash_init(&share_table, share_hash, share_less, NULL);
+	zero_frame = palloc_get_page(PAL_ZERO);
+	if (zero_frame == NULL)
+		PANIC ("couldn't allocate zero frame");
+	zero_frame = (void *) vtop(zero_frame);
 	lock_init(&frame_lock);
-	lock_init(&evict_lock);
+	cond_init(&frame_cond);
+
+	/* start paging out below 1/32 of the pool free, stop at twice that */
+	pageout_low = frame_cnt / 32;
+	if (pageout_low < PAGEOUT_LOW_MIN)
+		pageout_low = PAGEOUT_LOW_MIN;
+	pageout_high = 2 * pageout_low;
+	sema_init(&pageout_sema, 0);
+	timer_setup(&pageout_timer, pageout_wake, NULL);
+	thread_create("pageout", PRI_DEFAULT, pageout_daemon, NULL);
+}
+
+/* Returns a hash value for shared frame f, keyed by (inode, ofs) */
+static unsigned
+share_hash (const struct hash_elem *f_, void *aux UNUSED)
+{
+	const struct frame *f = hash_entry (f_, struct frame, share_elem);
+	return hash_int ((int) f->inode ^ f->ofs);
+}
+
+/* Returns true if shared frame a precedes shared frame b */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+	const struct frame *a = hash_entry (a_, struct frame, share_elem);
+	const struct frame *b = hash_entry (b_, struct frame, share_elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
 }
 
 /*
-	void add_frame_entry(void *paddr, void *vaddr, tid_t pid)
+	void add_frame_entry(void *paddr, struct s_pte *pte)
 	from s_pte_insert()
 
-	1. for every new mapping with frame addr & page addr, 
-		add new entry to frame table too.
-	2. use hash_replace that insert the entry
-		or replace(if there is) (remove the entry and insert new again).
+	for every new mapping with frame addr & page addr, 
+	add the s_pte to the reverse map of the frame.
+	a frame is mapped by more than one page only if it is shared.
 */
-
 void
-add_frame_entry(void *paddr, void *vaddr, tid_t pid)
+add_frame_entry(void *paddr, struct s_pte *pte)
 {
-	//printf("add_frame_entry vaddr : %p, paddr : %p\n", vaddr, paddr);
+	struct frame *f;
 
+	if (paddr == zero_frame)
+		return;
+	lock_acquire(&frame_lock);
+	f = frame_lookup_paddr (paddr);
+	ASSERT (f != NULL);
+	list_push_back(&f->rmap, &pte->frame_elem);
+	lock_release(&frame_lock);
+}
+
+
+/* 
+	drop the mapping of pte from the reverse map of its frame.
+	returns true if no page maps the frame any more and nobody has 
+	it pinned, the frame then leaves the share table and the caller 
+	owns it.  called before the paddr of pte is cleared
+*/
+bool
+free_frame_entry(struct s_pte *pte)
+{
 	struct frame *f;
-	
-/*
-	
-	f->paddr = paddr;
-	f->vaddr = vaddr;
-	f->pid = pid;
-	hash_replace(&frame_table, &f->hash_elem);
-*/	
+	bool unused;
+
+	if (pte->paddr == zero_frame)
+		return false;
 	lock_acquire(&frame_lock);
-	f= frame_lookup_paddr (paddr);
-	
-	if (f!=NULL){
-		f->vaddr = vaddr;
-		f->pid = pid;
-	}
-	else{
-		struct frame *new_f;
-		new_f = malloc(sizeof *f);
-		new_f->paddr = paddr;
-		new_f->vaddr = vaddr;
-		new_f->pid = pid;
-		list_push_back(&frame_table, &new_f->elem);
+	f = frame_lookup_paddr(pte->paddr);
+	ASSERT (f != NULL);
+	list_remove(&pte->frame_elem);
+	unused = list_empty(&f->rmap) && f->pin_cnt == 0;
+	if (unused && f->inode != NULL){
+		hash_delete(&share_table, &f->share_elem);
+		f->inode = NULL;
 	}
+	if (unused)
+		frame_available();
 	lock_release(&frame_lock);
-}
+	return unused;
+}	
 
 
 /* 
-	find frame table entry with va, pid
-	and then delete free entry 
+	mark the frame of paddr as holding the page at ofs of the 
+	read-only exec file inode, so that other processes running 
+	the same file map it instead of reading their own copy.
+	from find_s_pte(), the frame is mapped already.
+	if another process read the same page meanwhile, its frame stays
+	the shared one and this one private
 */
 void
-free_frame_entry(void *va, tid_t pid)
+frame_set_share(void *paddr, struct inode *inode, off_t ofs)
 {
-	//printf("free_frame_entry\n");
-	struct frame* f;
+	struct frame *f;
+
 	lock_acquire(&frame_lock);
-	f = frame_lookup_vaddr(va, pid);
-	if (f != NULL){
-		list_remove (&f->elem);
-	
-		free(f);
-	}
+	f = frame_lookup_paddr(paddr);
+	ASSERT (f != NULL && f->inode == NULL && !list_empty(&f->rmap));
+	f->inode = inode;
+	f->ofs = ofs;
+	if (hash_insert(&share_table, &f->share_elem) != NULL)
+		f->inode = NULL;
 	lock_release(&frame_lock);
+}
 
-	/*
-	if (f != NULL){
-		f->vaddr = NULL;
-		f->pid = NULL;
+
+/* Returns the shared frame holding the page at ofs of inode, 
+	or a null pointer if there is none.  the frame is returned 
+	pinned, so it is not evicted before the caller mapped it, 
+	the caller unpins it then */
+struct frame *
+frame_lookup_share(struct inode *inode, off_t ofs)
+{
+	struct frame key;
+	struct frame *f = NULL;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.ofs = ofs;
+	lock_acquire(&frame_lock);
+	e = hash_find(&share_table, &key.share_elem);
+	if (e != NULL){
+		f = hash_entry (e, struct frame, share_elem);
+		f->pin_cnt++;
 	}
-	*/
-	
+	lock_release(&frame_lock);
+	return f;
+}
 
-}	
+
+/* Returns the physical address of the zero frame */
+void *
+get_zero_frame(void)
+{
+	return zero_frame;
+}
 
 
-/* Returns the frame containing the given physical address (entry), 
-	or a null pointer if no such frame exists */
+/* Returns the frame descriptor of the given physical address, 
+	or a null pointer if it cannot hold a user page of its own
+	(the zero frame).
+	The descriptor is returned even if the frame is free. */
 struct frame *
 frame_lookup_paddr (void* paddr)
 {
-	struct list_elem *e;
-  	struct frame* f;
-  	for(e = list_begin(&frame_table); e!= list_end(&frame_table); e = list_next(e)){
-		f = list_entry (e, struct frame, elem);
-		if (f->paddr == paddr){
-			break;
+	size_t idx;
+
+	if (paddr == zero_frame)
+		return NULL;
+	idx = palloc_frame_idx(ptov((uintptr_t) paddr));
+	if (idx == SIZE_MAX)
+		return NULL;
+	return &frame_table[idx];
+}
+
+
+/* Get free frame from frame table and return uint32_t paddr.
+	the frame is zero filled either way.  no lock but the s_pt_lock
+	of the calling process may be held, the frame is not in any 
+	reverse map until the caller maps it, so nobody else takes it.
+	every frame may be busy for a while (pinned, or its process 
+	locked), it then waits until one may be available and tries 
+	again, so it never fails */
+void *
+get_free_frame(void)
+{
+	for (;;){
+		void *vaddr;
+		void *paddr;
+		unsigned event;
+
+		lock_acquire(&frame_lock);
+		event = frame_event;
+		lock_release(&frame_lock);
+
+		vaddr = palloc_get_page(PAL_USER | PAL_ZERO); 		//find a empty entry.
+		if (palloc_user_free_cnt() < pageout_low)
+			sema_up(&pageout_sema);
+		//case 1. if there are free frame
+		if(vaddr != NULL)
+			return (void *)vtop(vaddr);
+
+		//case 2. the daemon fell behind -> evict synchronously.
+		paddr = evict_frame();
+		if (paddr != NULL){
+			memset(ptov((uintptr_t) paddr), 0, PGSIZE);
+			return paddr;
 		}
-		f = NULL;
+
+		//case 3. nothing to evict -> wait for a frame to be unpinned
+		//  or freed, or for the daemon to free some
+		lock_acquire(&frame_lock);
+		while (event == frame_event)
+			cond_wait(&frame_cond, &frame_lock);
+		lock_release(&frame_lock);
 	}
-	//lock_release(&frame_lock);
+}
 
-	return NULL;
+/* wakes up the threads waiting in get_free_frame(), a frame may 
+	be available now.  called within frame_lock */
+static void
+frame_available (void)
+{
+	frame_event++;
+	cond_broadcast(&frame_cond, &frame_lock);
 }
 
+/*
+	1. choose frame to evict (page table의 accessed, dirty bits)
+	2. remove references to the frame from any page table
+	3. write the page to the file system / swap
 
-/* Returns the frame containing the given virtual address and pid, 
-	or a null pointer if no such frame exists */
-struct frame *
-frame_lookup_vaddr(const void *vaddr, tid_t pid)
+	returns the physical address of the frame, now owned by the caller,
+	or NULL if no frame can be evicted.
+	get_victim() hands over the victim pinned, with the s_pt_lock of
+	every process mapping it.  the I/O is done with only those held : 
+	a process faulting on the page waits for its own lock until the 
+	page is out, faults of other processes go on.
+*/
+static void *
+evict_frame(void)
 {
-	
-	struct list_elem *e;
-  	struct frame* f;
-  	for(e = list_begin(&frame_table); e!= list_end(&frame_table); e = list_next(e)){
-		f = list_entry (e, struct frame, elem);
-		if (f->vaddr == vaddr && f->pid == pid){
-			//lock_release(&frame_lock);
-			break;
+	bool self;
+	struct frame *victim = get_victim(&self);
+	void *paddr, *vaddr;
+	struct process *p;
+	struct s_pte *pte;
+	bool is_exec, dirty;
+	int mmap_id;
+
+	if (victim == NULL)
+		return NULL;
+	paddr = victim->paddr;
+	ASSERT(paddr < PHYS_BASE);
+
+	/* read-only exec page shared by processes running the same file,
+		or private page shared copy-on-write after fork */
+	if (list_size(&victim->rmap) > 1){
+		evict_shared_frame(victim);
+		frame_set_pinned(paddr, false);
+		return paddr;
+	}
+
+	pte = list_entry(list_front(&victim->rmap), struct s_pte, frame_elem);
+	vaddr = pte->vaddr;
+	p = pte->proc;
+	is_exec = pte->is_exec;
+	mmap_id = pte->mmap_id;
+
+	dirty = pagedir_is_dirty (p->thread->pagedir, vaddr);
+	free_frame_entry(pte);
+	s_pte_clear(vaddr, p); 
+	pagedir_clear_page (p->thread->pagedir, vaddr, p->pid);
+
+	/* mmap page : write back to its file only if dirty, never swap.
+		clean exec page : just drop it, it is re-read from the exec file.
+		others (and dirty exec pages) : swap out, together with the
+		virtually following pages that would be swapped out anyway */
+	if (mmap_id > 0){
+		if (dirty)
+			mmap_write_back(p, mmap_id, vaddr, paddr);
+	}
+	else if (!is_exec || dirty){
+		void *paddrs[SWAP_CLUSTER];
+		struct s_pte *ptes[SWAP_CLUSTER];
+		size_t slots[SWAP_CLUSTER];
+		size_t cnt, i;
+
+		paddrs[0] = paddr;
+		ptes[0] = pte;
+		cnt = 1 + swap_cluster_collect(p, vaddr, paddrs + 1, ptes + 1,
+		                               SWAP_CLUSTER - 1);
+		swap_out_cluster(paddrs, slots, cnt);		//physical memory에 빈공간 만들어
+		for (i = 0; i < cnt; i++){
+			ptes[i]->swap_slot = slots[i];
+			ptes[i]->is_exec = false;
 		}
-		f = NULL;
+		for (i = 1; i < cnt; i++){
+			frame_set_pinned(paddrs[i], false);
+			palloc_free_page(ptov((uintptr_t) paddrs[i]));
+		}
+	}
+
+	if (!self)
+		lock_release(&p->s_pt_lock);
+	frame_set_pinned(paddr, false);
+	return paddr;
+}
+
+/* evict frame f that is mapped by more than one process.
+	a shared exec page is read only and clean, it is just dropped.
+	a copy-on-write page is read-only everywhere, so it cannot change
+	while it is written out, and all sharers hold the same swap slot.
+	the lock of each process is released once its page is unmapped */
+static void
+evict_shared_frame (struct frame *f)
+{
+	struct s_pte *pte = list_entry(list_front(&f->rmap), struct s_pte, frame_elem);
+	size_t slot = SWAP_SLOT_NONE;
+	bool dirty = false;
+	struct list_elem *e;
 
+	ASSERT(pte->mmap_id <= 0);
+	for (e = list_begin(&f->rmap); e != list_end(&f->rmap); e = list_next(e)){
+		struct s_pte *m = list_entry(e, struct s_pte, frame_elem);
+		dirty = dirty || pagedir_is_dirty(m->proc->thread->pagedir, m->vaddr);
 	}
-	//lock_release(&frame_lock);
-	return f;
+	if (!pte->is_exec || dirty)
+		slot = swap_out(f->paddr);
 
+	while (!list_empty(&f->rmap)){
+		struct process *p;
+		void *vaddr;
+
+		pte = list_entry(list_front(&f->rmap), struct s_pte, frame_elem);
+		vaddr = pte->vaddr;
+		p = pte->proc;
+		free_frame_entry(pte);
+		s_pte_clear(vaddr, p);
+		pagedir_clear_page(p->thread->pagedir, vaddr, p->pid);
+		if (slot != SWAP_SLOT_NONE){
+			pte->swap_slot = list_empty(&f->rmap) ? slot : swap_dup(slot);
+			pte->is_exec = false;
+		}
+		lock_release(&p->s_pt_lock);
+	}
 }
 
-/* Get free frame from frame table and return uint32_t paddr */
+/* collect up to max resident pages of p that follow vaddr, for 
+	swapping out in one cluster with it.  the run stops at the first 
+	page that is not resident, is pinned, was accessed recently, or 
+	would not go to swap.  every collected page is unmapped, its
+	frame is free once swap_out_cluster() wrote it.  called within 
+	the s_pt_lock of p, so no other eviction takes these frames */
+static size_t
+swap_cluster_collect (struct process *p, void *vaddr, void **paddrs,
+                      struct s_pte **ptes, size_t max)
+{
+	uint32_t *pd = p->thread->pagedir;
+	size_t cnt;
+
+	if (pd == NULL)
+		return 0;
+	for (cnt = 0; cnt < max; cnt++){
+		void *va = (uint8_t *) vaddr + (cnt + 1) * PGSIZE;
+		struct s_pte *pte;
+		struct frame *f;
+		bool dirty;
+
+		if (!is_user_vaddr(va))
+			break;
+		pte = find_entry(va, p);
+		if (pte == NULL || pte->paddr == NULL || pte->mmap_id > 0)
+			break;
+		f = frame_lookup_paddr(pte->paddr);
+		if (f == NULL || f->pin_cnt > 0 || f->inode != NULL
+		    || list_size(&f->rmap) != 1 || pagedir_is_accessed(pd, va))
+			break;
+		dirty = pagedir_is_dirty(pd, va);
+		if (pte->is_exec && !dirty)
+			break;
+
+		paddrs[cnt] = pte->paddr;
+		ptes[cnt] = pte;
+		frame_set_pinned(pte->paddr, true);
+		free_frame_entry(pte);
+		s_pte_clear(va, p);
+		pagedir_clear_page(pd, va, p->pid);
+	}
+	return cnt;
+}
+
+/* returns a free frame for swap-in readahead, or NULL if taking
+	it would bring the free pages below the page-out watermark.
+	unlike get_free_frame() this never evicts */
 void *
-get_free_frame(void)
+get_spare_frame(void)
+{
+	void *kpage;
+
+	if (palloc_user_free_cnt() <= pageout_high)
+		return NULL;
+	kpage = palloc_get_page(PAL_USER);
+	return kpage != NULL ? (void *) vtop(kpage) : NULL;
+}
+
+/* page-out daemon.
+	woken by get_free_frame() when the pages free for user pages
+	drop below pageout_low, it evicts frames and gives them back to
+	the pool until pageout_high frames are free again, so that a
+	faulting process usually finds a free frame and does no I/O.
+	if every frame is busy, it sets a timer to try again later.
+	after every run that leaves free pages, it wakes up the threads
+	waiting for a frame in get_free_frame().  it holds no lock of 
+	its own, only those of the processes whose frame it is evicting */
+static void
+pageout_daemon (void *aux UNUSED)
 {
-	//lock_acquire(&lock);
-	//printf("get_free_frame\n");
-	void *vaddr;
-	
-	vaddr = palloc_get_page(PAL_USER | PAL_ZERO); 		//find a empty entry.
-	//case 1. if there are free frame
-	if(vaddr != NULL){
-		
-		return (void *)vtop(vaddr);
+	for (;;){
+		sema_down(&pageout_sema);
+		while (palloc_user_free_cnt() < pageout_high){
+			void *paddr;
+
+			paddr = evict_frame();
+			if (paddr == NULL){
+				if (!timer_pending(&pageout_timer))
+					timer_add(&pageout_timer, PAGEOUT_RETRY_TICKS);
+				break;
+			}
+			palloc_free_page(ptov((uintptr_t) paddr));
+		}
+		if (palloc_user_free_cnt() > 0){
+			lock_acquire(&frame_lock);
+			frame_available();
+			lock_release(&frame_lock);
+		}
 	}
-	//case 2. there are no free frame -> eviction
-	else{
-		/*
-		1. choose frame to evict (page table의 accessed, dirty bits)
-		2. remove references to the frame from any page table
-		3. write the page to the file system / swap
-		*/
-		//get victim's paddr from s-pagetable
+}
 
-		struct s_pte *victim = get_victim();
-		uint32_t paddr = (uint32_t) victim->paddr;
-		uint32_t vaddr = (uint32_t) victim->vaddr;
-		ASSERT((void *) paddr < PHYS_BASE);
-		uint32_t *pd;
-		struct process *p = find_process(victim->pid);
+/* pageout_timer function, wakes up the page-out daemon */
+static void
+pageout_wake (void *aux UNUSED)
+{
+	sema_up(&pageout_sema);
+}
 
-		free_frame_entry(vaddr, victim->pid);
-		s_pte_clear(vaddr, victim->pid); 
-		if (p!= NULL && p->thread->pagedir !=NULL)
-			pagedir_clear_page (p->thread->pagedir, vaddr, victim->pid);
+/* find a victim frame with the clock (second chance) algorithm.
 
+	the hand sweeps the frame table from where the last sweep stopped.
+	a frame that any of its pages accessed gets a second chance : the 
+	bits are cleared and the hand moves on.  among frames not accessed, 
+	a clean frame is taken right away, and the first dirty one is kept 
+	as a fallback until the hand has gone around once.  free and pinned
+	frames are skipped, so are frames of a process that is busy with 
+	its table (frame_lock_owners()).  returns NULL if no frame is left.
 
-		if(!victim->is_exec)
-			swap_out(paddr, vaddr, victim->pid);		//physical memory에 빈공간 만들어
-		
+	the victim is returned pinned and out of the share table, together 
+	with the s_pt_lock of every process mapping it.  *self is set if 
+	that is the lock of the calling process, held already */
+struct frame *
+get_victim (bool *self)
+{
+	static size_t hand;
+	struct frame *victim = NULL;
+	bool victim_self = false;
+	size_t victim_hand = 0;
+	size_t i;
+
+	lock_acquire(&frame_lock);
+	for (i = 0; i < 2 * frame_cnt; i++){
+		struct frame *f = &frame_table[hand];
+		bool accessed = false, dirty = false, f_self;
+		struct list_elem *e;
+
+		if (i == frame_cnt && victim != NULL)
+			break;
+		hand = (hand + 1) % frame_cnt;
 
-		
-		
+		if (list_empty(&f->rmap) || f->pin_cnt > 0)
+			continue;
+		if (!frame_lock_owners(f, &f_self))
+			continue;
+		for (e = list_begin(&f->rmap); e != list_end(&f->rmap); e = list_next(e)){
+			struct s_pte *pte = list_entry(e, struct s_pte, frame_elem);
+			uint32_t *pd = pte->proc->thread->pagedir;
 
-		return (void *) paddr;
-		//swap_in에서 victim_frame->vaddr로 넣어줌 
-		
+			if (pagedir_is_accessed(pd, pte->vaddr)){
+				pagedir_set_accessed(pd, pte->vaddr, false);
+				accessed = true;
+			}
+			dirty = dirty || pagedir_is_dirty(pd, pte->vaddr);
+		}
+		if (accessed || (dirty && victim != NULL)){
+			frame_unlock_owners(f, list_end(&f->rmap), f_self);
+			continue;
+		}
+		if (victim != NULL)
+			frame_unlock_owners(victim, list_end(&victim->rmap), victim_self);
+		victim = f;
+		victim_self = f_self;
+		victim_hand = hand;
+		if (!dirty)
+			break;
+	}
+	if (victim != NULL){
+		/* resume the next sweep right after the victim */
+		hand = victim_hand;
+		victim->pin_cnt++;
+		if (victim->inode != NULL){
+			hash_delete(&share_table, &victim->share_elem);
+			victim->inode = NULL;
+		}
 	}
-	
+	lock_release(&frame_lock);
+	*self = victim_self;
+	return victim;
 }
 
-void
-free_frame_process(tid_t pid)
+/* take the s_pt_lock of every process mapping f without waiting, 
+	so that a fault, which holds the lock of its own process while 
+	it evicts, never waits for another one.  the lock of the calling
+	process may be held already only if it maps f alone, *self is 
+	then set.  fails if a lock is busy or a process has torn down its
+	page directory.  called within frame_lock */
+static bool
+frame_lock_owners (struct frame *f, bool *self)
 {
 	struct list_elem *e;
-  	lock_acquire(&frame_lock);
-  	
-  	e = list_begin(&frame_table);
-  	while (e!= list_end(&frame_table))
-  	{
-  		struct frame* f;
-  		f = list_entry(e, struct frame, elem);
-  		ASSERT(e!= list_end(&frame_table));
-  		e = list_next(e);
-	    if (f->pid == pid){
-	    	list_remove(&f->elem);
-	    	
-	    	free(f);
-	    	//free_frame_entry(vaddr, pid);
-	    	
-	    }
-	   
-	    	
-  	}
-  	lock_release(&frame_lock);
 
+	*self = false;
+	for (e = list_begin(&f->rmap); e != list_end(&f->rmap); e = list_next(e)){
+		struct s_pte *pte = list_entry(e, struct s_pte, frame_elem);
+		struct process *p = pte->proc;
+
+		if (lock_held_by_current_thread(&p->s_pt_lock)){
+			if (list_size(&f->rmap) != 1)
+				break;
+			*self = true;
+		}
+		else if (!lock_try_acquire(&p->s_pt_lock))
+			break;
+		if (p->thread->pagedir == NULL){
+			if (!*self)
+				lock_release(&p->s_pt_lock);
+			*self = false;
+			break;
+		}
+	}
+	if (e == list_end(&f->rmap))
+		return true;
+	frame_unlock_owners(f, e, false);
+	return false;
+}
+
+/* release the locks frame_lock_owners() took for the mappings of f 
+	before stop.  nothing was taken if self is set */
+static void
+frame_unlock_owners (struct frame *f, struct list_elem *stop, bool self)
+{
+	struct list_elem *e;
+
+	if (self)
+		return;
+	for (e = list_begin(&f->rmap); e != stop; e = list_next(e)){
+		struct s_pte *pte = list_entry(e, struct s_pte, frame_elem);
+		lock_release(&pte->proc->s_pt_lock);
+	}
+}
+
+/* Returns the number of pages mapping the frame of paddr */
+size_t
+frame_map_cnt (void *paddr)
+{
+	struct frame *f;
+	size_t cnt;
+
+	lock_acquire(&frame_lock);
+	f = frame_lookup_paddr(paddr);
+	ASSERT (f != NULL);
+	cnt = list_size(&f->rmap);
+	lock_release(&frame_lock);
+	return cnt;
 }
 
+/* pin or unpin the frame of physical address paddr.
+	pins nest, a frame is never chosen by get_victim() while any 
+	pin is left */
+void
+frame_set_pinned (void *paddr, bool pinned)
+{
+	struct frame *f;
 
+	lock_acquire(&frame_lock);
+	f = frame_lookup_paddr(paddr);
+	if (f != NULL){
+		ASSERT (pinned || f->pin_cnt > 0);
+		f->pin_cnt += pinned ? 1 : -1;
+		if (f->pin_cnt == 0)
+			frame_available();
+	}
+	lock_release(&frame_lock);
+}
+
+/* write the evicted frame of paddr back to the mmap'ed file it came from.
+	called within the s_pt_lock of p, filesys_lock is taken after it */
+static void
+mmap_write_back (struct process *p, int mmap_id, void *vaddr, void *paddr)
+{
+	struct mapping *map = find_mapping_id(&p->mapping_list, mmap_id);
+	struct fte *fte;
+
+	ASSERT (map != NULL);
+	fte = find_fte(&map->file_table, vaddr);
+	ASSERT (fte != NULL);
+	lock_acquire(&filesys_lock);
+	file_write_at(map->file, ptov((uintptr_t) paddr), fte->size, fte->ofs);
+	lock_release(&filesys_lock);
+}
@@ -7,28 +7,42 @@
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "userprog/process.h"
-
+#include "filesys/off_t.h"
+
+struct s_pte;
+struct inode;
+
+/* Frame descriptor.  One descriptor exists for every page that
+   may hold a user page, i.e. of the user pool and of the kernel
+   pool, which lends pages to it, at the index palloc_frame_idx()
+   gives for it, so finding the descriptor of a physical address
+   is O(1).
+   The pages mapping a frame are found through its reverse map of
+   s_ptes.  More than one page maps a frame if it holds a read-only
+   exec page that is shared by every process running the same file
+   (such frames are also in the share table), or a private page 
+   that fork() shares copy-on-write.
+   A frame is pinned while a fault maps it from the share table, 
+   while a page is copied out of it, and while it is evicted. */
 struct frame {
-	struct list_elem elem;			/* Hash table element */
-	void *paddr;						/* (key of hash) physical address */
-	void *vaddr;						/* points virtual address page */
-	tid_t pid;							/* process's pid that allocate this frame */		
+	struct list rmap;					/* s_ptes mapping this frame, empty : free frame */
+	void *paddr;						/* physical address of this frame */
+	int pin_cnt;						/* > 0 : must not be evicted */
+	struct inode *inode;				/* shared exec page : file inode, NULL : private */
+	off_t ofs;							/* shared exec page : file offset */
+	struct hash_elem share_elem;		/* share table element */
 };
 
 
-struct list frame_table;
-struct lock evict_lock;
-
-
-
-
-
-
 void frametable_init(void);
-void add_frame_entry(void *, void *, tid_t);
-void free_frame_entry(void *, tid_t);
+void add_frame_entry(void *, struct s_pte *);
+bool free_frame_entry(struct s_pte *);
+void frame_set_share(void *, struct inode *, off_t);
+struct frame * frame_lookup_share(struct inode *, off_t);
 struct frame * frame_lookup_paddr(void*);
-struct frame * frame_lookup_vaddr(const void *, tid_t);
+size_t frame_map_cnt(void *);
 void * get_free_frame(void);
-void free_frame_process(tid_t);
-
+void * get_spare_frame(void);
+void * get_zero_frame(void);
+struct frame * get_victim(bool *);
+void frame_set_pinned(void *, bool);
@@ -0,0 +1,189 @@
+#include "vm/lz.h"
+#include <string.h>
+#include <debug.h>
+
+
+/* match finder : last position of every hashed 4-byte sequence.
+	only one page is compressed at a time (within swap_lock) */
+#define LZ_HASH_BITS 12
+static uint16_t lz_hash[1 << LZ_HASH_BITS];
+
+static uint8_t *put_count (uint8_t *, uint8_t *, size_t);
+static uint8_t *put_sequence (uint8_t *, uint8_t *, const uint8_t *, size_t, 
+                              size_t, size_t);
+
+
+/* Returns the 4 bytes at p */
+static inline uint32_t
+read32 (const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+/* Returns the hash table index of 4-byte sequence v */
+static inline size_t
+lz_hash_index (uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+
+/*
+	size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+	from swap_out_cluster()
+
+	compress the n bytes of src (at most 64 kB) into dst.
+	returns the compressed size, or 0 if it would not fit in cap bytes.
+	greedy parsing : at every position the last occurrence of the 
+	next 4 bytes is looked up, a hit is extended as far as it goes.
+*/
+size_t
+lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+	const uint8_t *ip = src, *anchor = src;
+	const uint8_t *end = src + n;
+	uint8_t *op = dst, *oend = dst + cap;
+
+	ASSERT (n <= UINT16_MAX);
+	memset(lz_hash, 0, sizeof lz_hash);
+
+	while (ip + LZ_MIN_MATCH <= end){
+		uint32_t seq = read32(ip);
+		size_t h = lz_hash_index(seq);
+		const uint8_t *ref = src + lz_hash[h];
+		size_t len;
+
+		lz_hash[h] = ip - src;
+		if (ref >= ip || read32(ref) != seq){
+			ip++;
+			continue;
+		}
+		for (len = LZ_MIN_MATCH; ip + len < end && ref[len] == ip[len]; len++)
+			continue;
+		op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, len);
+		if (op == NULL)
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+
+	/* last literals */
+	op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+	return op != NULL ? (size_t) (op - dst) : 0;
+}
+
+
+/* put the part of count that does not fit in a token nibble.
+	returns NULL if it does not fit before oend */
+static uint8_t *
+put_count (uint8_t *op, uint8_t *oend, size_t count)
+{
+	for (; count >= 255; count -= 255){
+		if (op == oend)
+			return NULL;
+		*op++ = 255;
+	}
+	if (op == oend)
+		return NULL;
+	*op++ = count;
+	return op;
+}
+
+/* put one sequence : lit_cnt literals, then a match of len bytes at
+	offset back, or no match if len is 0.
+	returns the end of the output, NULL if it does not fit before oend */
+static uint8_t *
+put_sequence (uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t lit_cnt, 
+              size_t offset, size_t len)
+{
+	size_t mlen = len != 0 ? len - LZ_MIN_MATCH : 0;
+
+	if (op == oend)
+		return NULL;
+	*op++ = (lit_cnt < 15 ? lit_cnt : 15) << 4 | (mlen < 15 ? mlen : 15);
+	if (lit_cnt >= 15 && (op = put_count(op, oend, lit_cnt - 15)) == NULL)
+		return NULL;
+	if ((size_t) (oend - op) < lit_cnt)
+		return NULL;
+	memcpy(op, lit, lit_cnt);
+	op += lit_cnt;
+	if (len == 0)
+		return op;
+
+	if (oend - op < 2)
+		return NULL;
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	if (mlen >= 15 && (op = put_count(op, oend, mlen - 15)) == NULL)
+		return NULL;
+	return op;
+}
+
+
+/* read a count that goes on after a token nibble of 15.
+	returns false if the input ends first */
+static bool
+get_count (const uint8_t **ip, const uint8_t *iend, size_t *count)
+{
+	uint8_t b;
+
+	do {
+		if (*ip == iend)
+			return false;
+		b = *(*ip)++;
+		*count += b;
+	} while (b == 255);
+	return true;
+}
+
+/*
+	bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size)
+	from swap_in()
+
+	decompress the n bytes of src into dst, which takes exactly size 
+	bytes.  returns false if the stream is corrupt.
+*/
+bool
+lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size)
+{
+	const uint8_t *ip = src, *iend = src + n;
+	uint8_t *op = dst, *oend = dst + size;
+
+	while (ip < iend){
+		uint8_t token = *ip++;
+		size_t lit_cnt = token >> 4;
+		size_t len = token & 15;
+		size_t offset;
+		const uint8_t *ref;
+
+		if (lit_cnt == 15 && !get_count(&ip, iend, &lit_cnt))
+			return false;
+		if ((size_t) (iend - ip) < lit_cnt || (size_t) (oend - op) < lit_cnt)
+			return false;
+		memcpy(op, ip, lit_cnt);
+		ip += lit_cnt;
+		op += lit_cnt;
+
+		/* last sequence */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return false;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (len == 15 && !get_count(&ip, iend, &len))
+			return false;
+		len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst) 
+		    || (size_t) (oend - op) < len)
+			return false;
+
+		/* byte by byte, a match may overlap its own output */
+		for (ref = op - offset; len > 0; len--)
+			*op++ = *ref++;
+	}
+	return op == oend;
+}
@@ -0,0 +1,21 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 
+LZ77 COMPRESSOR FOR SWAPPED OUT PAGES
+
+a stream of sequences, each one is
+	token		high 4 bits : literal count, low 4 bits : match length - LZ_MIN_MATCH
+				(15 : the count goes on in the following bytes, 255 : one more byte)
+	literals	copied as is
+	offset		2 bytes little endian, how far back the match starts
+	the last sequence has literals only, and ends the stream.
+*/
+
+/* Shortest match worth an offset. */
+#define LZ_MIN_MATCH 4
+
+
+size_t lz_compress(const uint8_t *, size_t, uint8_t *, size_t);
+bool lz_decompress(const uint8_t *, size_t, uint8_t *, size_t);
@@ -1,8 +1,10 @@
 #include "vm/s-pagetable.h"
 #include <stdio.h>
+#include <string.h>
 #include "threads/synch.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "userprog/pagedir.h"
 #include "threads/pte.h"
@@ -18,9 +20,21 @@
 #include "vm/mmap-table.h"
 
 
-struct list s_page_table;
-struct lock s_pt_lock;
-struct lock swapin_lock;
+static unsigned s_pte_hash (const struct hash_elem *, void * UNUSED);
+static bool s_pte_less (const struct hash_elem *, const struct hash_elem *, void * UNUSED);
+static void s_pte_destroy (struct hash_elem *, void * UNUSED);
+static void swap_readahead (struct process *, void *, size_t);
+static void fault_around (struct process *, struct list *, struct file *, struct fte *);
+
+/* cache every s_pte is allocated from */
+static struct slab_cache s_pte_cache;
+
+/* fault-around window, in pages after the faulting one.  it starts 
+	at FAULT_AROUND_MIN and doubles up to FAULT_AROUND_MAX while the 
+	faults of a process follow each other sequentially */
+#define FAULT_AROUND_MIN 4
+#define FAULT_AROUND_MAX 32
+
 /*
   1. page fault가 난 page를 supplemental page table에 위치
   memory reference가 valid 이면 -> supplemental page table entry 를 이용하여 
@@ -42,14 +56,53 @@ struct lock swapin_lock;
   4. fault가 발생한 page table entry의 fulting virtul address-> physical page 이도록 만들어라 (userprog/pagedir.c) 
 */
 
+/* init the cache every s_pte is allocated from */
+void
+s_pte_init(void)
+{
+	slab_cache_init(&s_pte_cache, "s_pte", sizeof (struct s_pte), NULL);
+}
+
+/* init the supplemental page table of process p, 
+	every process owns its table and lock */
 void 
-init_s_page_table(void)
+s_page_table_init(struct process *p)
 {
-	list_init(&s_page_table);
-	lock_init(&s_pt_lock);
-	lock_init(&swapin_lock);
+	hash_init(&p->s_page_table, s_pte_hash, s_pte_less, NULL);
+	lock_init(&p->s_pt_lock);
+	p->fault_next = NULL;
+	p->fault_window = FAULT_AROUND_MIN;
 }
 
+/* Returns a hash value for s_pte s */
+static unsigned
+s_pte_hash (const struct hash_elem *s_, void *aux UNUSED)
+{
+	const struct s_pte *s = hash_entry (s_, struct s_pte, elem);
+	return hash_bytes (&s->vaddr, sizeof s->vaddr);
+}
+
+/* Returns true if s_pte a precedes s_pte b */
+static bool
+s_pte_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+	const struct s_pte *a = hash_entry (a_, struct s_pte, elem);
+	const struct s_pte *b = hash_entry (b_, struct s_pte, elem);
+
+	return a->vaddr < b->vaddr;
+}
+
+/* free s_pte and its swap slot, used when destroying a process's table.
+	the frame of the page is freed too, unless other processes share it */
+static void
+s_pte_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+	struct s_pte *pte = hash_entry (e, struct s_pte, elem);
+	if (pte->paddr != NULL && free_frame_entry (pte))
+		palloc_free_page (ptov ((uintptr_t) pte->paddr));
+	swap_free (pte->swap_slot);
+	slab_free (&s_pte_cache, pte);
+}
 
 
 
@@ -63,86 +116,120 @@ what resources to free를 찾음
 */
 
 /*
-	void s_pte_insert(void *va, void *pa, tid_t pid)
+	void s_pte_insert(void *va, void *pa, struct process *p, int mmap_id)
 	from pagedir_set_page()
 	
 	1. when need add mapping, add mapping to supplemental page table also.
-	2. latest one is always on the front, oldest one is always on the back.
-	3. (va, pid) combination is the key.
+	2. every process has its own table, va is the key.
+	3. an existing entry of va is updated in place.
 	4. always add mapping to frame table too. (두 테이블을 맞게 유지해주기위해)
+	5. the s_pt_lock of the process is taken unless the caller holds it.
+	6. returns false if a new entry cannot be allocated.
 
 */
-void
-s_pte_insert(void *va, void *pa, tid_t pid, int mmap_id)
+bool
+s_pte_insert(void *va, void *pa, struct process *p, int mmap_id)
 {
 	//table entry에 va, pa, pid를 넣어서 table에 추가해준다.
-	//printf("s_pte_insert paddr %p, vaddr %p, pid %d\n", pa, va, pid);
-	uint32_t vaddr = va;
-	//uint32_t paddr = pa;
 	struct s_pte *pte;
-	struct s_pte *find_pte;
-	pte = malloc(sizeof *pte);
-
-	pte->vaddr = vaddr;
+	bool held;
+	ASSERT (p != NULL);
+
+	held = lock_held_by_current_thread(&p->s_pt_lock);
+	if (!held)
+		lock_acquire(&p->s_pt_lock);
+	pte = find_entry(va, p);
+	if (pte == NULL){
+		pte = slab_alloc(&s_pte_cache);
+		if (pte == NULL){
+			if (!held)
+				lock_release(&p->s_pt_lock);
+			return false;
+		}
+		/* a recycled object still holds its last owner's fields */
+		pte->vaddr = va;
+		pte->paddr = NULL;
+		pte->proc = p;
+		pte->swap_slot = SWAP_SLOT_NONE;
+		pte->is_exec = false;
+		pte->mmap_id = mmap_id;
+		pte->cow = false;
+		hash_insert(&p->s_page_table, &pte->elem);
+	}
+	ASSERT (pte->paddr == NULL);
 	pte->paddr = pa;
-	pte->pid = pid;
-	pte->is_swapout = false;
 	pte->mmap_id = mmap_id;
 	
-	// (LAZY LOADING)
+	// (LAZY LOADING) a file backed page stays file backed after it is loaded,
+	// so that eviction can drop it when it is clean
 	if (pa == NULL)
 		pte->is_exec = true;
-	else
-		pte->is_exec = false;
-		
-	lock_acquire(&s_pt_lock);
-	find_pte = find_entry((void *)vaddr, pid);
-	
-	
-	if (find_pte !=NULL){
-		//pte->is_exec = find_pte->is_exec;
-		list_remove(&find_pte->elem);
-		free(find_pte);
-	}
-	list_push_front(&s_page_table, &pte->elem);
-	lock_release(&s_pt_lock);
+	if (!held)
+		lock_release(&p->s_pt_lock);
+
 	if (pa !=NULL)			//(LAZY LOADING)
-		add_frame_entry(pa, va, pid);
+		add_frame_entry(pa, pte);
+	return true;
 }
 
 /*
-	void s_pte_clear(void *va, tid_t pid)
+	void s_pte_clear(void *va, struct process *p)
 	from pagedir_clear_page()
-	
+	the s_pt_lock of the process is taken unless the caller holds it
 */
 void
-s_pte_clear (void *va, tid_t pid)
+s_pte_clear (void *va, struct process *p)
 {
-	//table entry 중에서 va, pid를 가진 애를 delete 함
-	
-	//printf("s_pte_clear vaddr %p, pid %d\n", va, pid);
-	lock_acquire(&s_pt_lock);
-	struct s_pte *entry = find_entry(va, pid);
+	//table entry 중에서 va, pid를 가진 애의 frame을 지움
+	bool held;
+	ASSERT (p != NULL);
+
+	held = lock_held_by_current_thread(&p->s_pt_lock);
+	if (!held)
+		lock_acquire(&p->s_pt_lock);
+	struct s_pte *entry = find_entry(va, p);
 	ASSERT (entry != NULL);
 	entry->paddr = NULL;
+	if (!held)
+		lock_release(&p->s_pt_lock);
+}
+/*
+	void s_pte_remove(void *va, struct process *p)
+	from free_mapping()
 
-	
-
-	list_remove(&entry->elem);
-	list_push_front(&s_page_table, &entry->elem);
-
-	lock_release(&s_pt_lock);
-		//frame table에서 해당 frame에 대한 mapping제거
-
+	drop the entry of va from the table of p and free it, once the
+	page is not mapped at all any more, so that a later access to it 
+	faults like an access to any unmapped page.  the page must not be
+	resident.  called within the s_pt_lock of p
+*/
+void
+s_pte_remove (void *va, struct process *p)
+{
+	struct s_pte *entry;
+
+	ASSERT (lock_held_by_current_thread(&p->s_pt_lock));
+	entry = find_entry(va, p);
+	if (entry == NULL)
+		return;
+	ASSERT (entry->paddr == NULL);
+	hash_delete(&p->s_page_table, &entry->elem);
+	swap_free(entry->swap_slot);
+	slab_free(&s_pte_cache, entry);
 }
+
 /* 
 	
 	from page_fault()
 	
 	1. find the page entry that is not in physical memory now
+	2. the whole fault, disk I/O included, runs within the s_pt_lock
+		of the process : faults of other processes go on meanwhile, 
+		and an eviction of one of its pages is waited for
+	3. the file system is not thread safe, a file read takes 
+		filesys_lock too, always after the s_pt_lock
 */
 void *
-find_s_pte (void *vaddr, tid_t pid)
+find_s_pte (void *vaddr, struct process *p, bool write)
 {
 	
 		/*
@@ -157,32 +244,67 @@ find_s_pte (void *vaddr, tid_t pid)
 	*/
 	//printf("find_s_pte\n");
 	
-	lock_acquire(&evict_lock);
-	lock_acquire(&s_pt_lock);
-	struct s_pte *entry = find_entry(vaddr, pid);
+	if (p == NULL)
+		return NULL;
+
+	lock_acquire(&p->s_pt_lock);
+	struct s_pte *entry = find_entry(vaddr, p);
 	if( entry == NULL)
 	{
-		lock_release(&s_pt_lock);
-		lock_release(&evict_lock);
+		lock_release(&p->s_pt_lock);
 		return NULL;
 	}
 	
 	if (entry->paddr == NULL)		//swap out된 경우
 	{
-		lock_release(&s_pt_lock);
-
-		void *free_frame = get_free_frame();				//if memory full -> swap out
-		struct process *p = find_process(pid);
-		if (p == NULL || p->thread->pagedir ==NULL)
+		if (p->thread->pagedir ==NULL)
 		{
-			lock_release(&evict_lock);
+			lock_release(&p->s_pt_lock);
 			return NULL;
 		}
 		uint32_t *pd;
 		pd = p->thread->pagedir;
 		bool writable;
 
-		/* lazy loading & mmap */
+		/* exec page without file data (bss) : map the zero frame, 
+			a frame is taken only when the page is written.
+			read-only exec page : another process running the same file
+			may have it in a frame already, then just map that frame */
+		struct inode *share_inode = NULL;
+		off_t share_ofs = 0;
+		if (entry->mmap_id <= 0 && entry->is_exec)
+		{
+			struct fte *fte_ = find_fte(&p->load_file_table, entry->vaddr);
+			if (fte_->size == 0 && !write)
+			{
+				s_pte_map_zero(vaddr, p, fte_->writable, entry->mmap_id);
+				lock_release(&p->s_pt_lock);
+				return vaddr;
+			}
+			if (!fte_->writable)
+			{
+				struct frame *shared;
+				share_inode = file_get_inode(p->exec_file);
+				share_ofs = fte_->ofs;
+				shared = frame_lookup_share(share_inode, share_ofs);
+				if (shared != NULL)
+				{
+					pagedir_set_page (pd, vaddr, ptov((uintptr_t) shared->paddr), false, entry->mmap_id);
+					frame_set_pinned(shared->paddr, false);
+					fault_around(p, &p->load_file_table, p->exec_file, fte_);
+					lock_release(&p->s_pt_lock);
+					return vaddr;
+				}
+			}
+		}
+
+		void *free_frame = get_free_frame();				//if memory full -> swap out
+		struct list *around_table = NULL;		/* file backed : fault around in this table */
+		struct file *around_file = NULL;
+		struct fte *around_fte = NULL;
+
+		/* lazy loading & mmap 
+			(a dirty exec page that was swapped out is no longer file backed) */
 		
 		if (entry->mmap_id >0)
 		{
@@ -197,10 +319,14 @@ find_s_pte (void *vaddr, tid_t pid)
 
 			//printf("free frame %p, fte size : %d, ofs : %d\n", free_frame, fte_->size, fte_->ofs);
 			
-			int re =file_read_at(f, ptov(free_frame), fte_->size, fte_->ofs);
-			//printf("re : %d\n", re);
-				memset(ptov(free_frame) + fte_->size, 0, PGSIZE-fte_->size);
+			/* the frame is zeroed, only the file data is read */
+			lock_acquire(&filesys_lock);
+			file_read_at(f, ptov((uintptr_t) free_frame), fte_->size, fte_->ofs);
+			lock_release(&filesys_lock);
 				writable = fte_->writable;
+			around_table = &map->file_table;
+			around_file = f;
+			around_fte = fte_;
 			
 		}
 		
@@ -212,31 +338,44 @@ find_s_pte (void *vaddr, tid_t pid)
 			struct fte * fte_;
 			fte_ = find_fte(&p->load_file_table, entry->vaddr);
 			struct file * f = p->exec_file;
-			file_read_at(f, ptov(free_frame), fte_->size, fte_->ofs);
-			memset(ptov(free_frame) + fte_->size, 0, PGSIZE-fte_->size);
+			lock_acquire(&filesys_lock);
+			file_read_at(f, ptov((uintptr_t) free_frame), fte_->size, fte_->ofs);
+			lock_release(&filesys_lock);
 			writable = fte_->writable;
+			around_table = &p->load_file_table;
+			around_file = f;
+			around_fte = fte_;
 		}
 	
 		else
 		{
 			//printf("swap in\n");
-			swap_in(free_frame, vaddr, pid);
-			writable = pagedir_is_writable(pd, vaddr);
+			size_t slot = entry->swap_slot;
+			swap_in(free_frame, slot);
+			entry->swap_slot = SWAP_SLOT_NONE;
+			writable = pagedir_is_writable(pd, vaddr) || entry->cow;
+			swap_readahead(p, vaddr, slot);
 		}
 
 
 		
 		
-		pagedir_set_page (pd, vaddr, ptov(free_frame), writable, entry->mmap_id);	
-		lock_release(&evict_lock);
+		/* the frame is private now, a copy-on-write page is writable again */
+		entry->cow = false;
+		pagedir_set_page (pd, vaddr, ptov((uintptr_t) free_frame), writable, entry->mmap_id);	
+		if (share_inode != NULL)
+			frame_set_share(free_frame, share_inode, share_ofs);
+		if (around_table != NULL)
+			fault_around(p, around_table, around_file, around_fte);
+		lock_release(&p->s_pt_lock);
 		return vaddr;
 	}
 	else{
-		printf(" find spte entry paddr : %p, vaddr : %p, pid :%d\n", entry->paddr, entry->vaddr, entry->pid);
-		lock_release(&evict_lock);
+		printf(" find spte entry paddr : %p, vaddr : %p, pid :%d\n", entry->paddr, entry->vaddr, entry->proc->pid);
+		lock_release(&p->s_pt_lock);
 		ASSERT(0);
 		printf("find_s_pte FAIL\n");
-		find_process(pid)->exit_status = -1;
+		p->exit_status = -1;
       	thread_exit();
 
       	return NULL;
@@ -246,80 +385,284 @@ find_s_pte (void *vaddr, tid_t pid)
 }
 
 
-/* find a victim frmae with FIFO algorithm. called within lock */
-struct s_pte *
-get_victim (void)
+/*
+	swap in the pages that follow vaddr, while they sit in the swap slots 
+	that follow slot, i.e. they were swapped out in the same cluster.
+	only done while free frames are plentiful (get_spare_frame()), 
+	the pages are mapped not accessed so the clock takes them back 
+	first if they are never used.  called within the s_pt_lock of p
+*/
+static void
+swap_readahead (struct process *p, void *vaddr, size_t slot)
 {
-	//printf("get_victim\n");
-	struct s_pte *pte;
-	lock_acquire(&s_pt_lock);
-	pte = list_entry(list_back(&s_page_table), struct s_pte, elem);
-	/* page linear - don't swap out stack space */
-	
-	while (pte->paddr == NULL && find_process(pte->pid) != NULL){
-
-		//ASSERT(find_process(pte->pid));
-		//ASSERT(!find_process(pte->pid)->is_dead);
+	uint32_t *pd = p->thread->pagedir;
+	size_t i;
+
+	for (i = 1; i < SWAP_CLUSTER; i++){
+		void *va = (uint8_t *) vaddr + i * PGSIZE;
+		struct s_pte *entry;
+		void *frame;
+		bool ok, writable;
+
+		if (!is_user_vaddr(va))
+			break;
+		entry = find_entry(va, p);
+		ok = entry != NULL && entry->paddr == NULL && entry->mmap_id <= 0
+			&& entry->swap_slot == slot + i;
+		if (!ok || (frame = get_spare_frame()) == NULL)
+			break;
+
+		swap_in(frame, entry->swap_slot);
+		entry->swap_slot = SWAP_SLOT_NONE;
+		writable = pagedir_is_writable(pd, va) || entry->cow;
+		entry->cow = false;
+		pagedir_set_page (pd, va, ptov((uintptr_t) frame), writable, entry->mmap_id);
+	}
+}
 
-		list_remove(&pte->elem);
-		list_push_front(&s_page_table, &pte->elem);
-		pte = list_entry(list_back(&s_page_table), struct s_pte, elem);
 
-	}
-	lock_release(&s_pt_lock);
+/*
+	fault around a file backed page fault at fte of file_table.
+	the pages of the following ftes are loaded too, while they are 
+	virtually contiguous, not present and never swapped out, as long
+	as free frames are plentiful (get_spare_frame()).  read-only exec
+	pages already shared by another process are just mapped.
+	a fault right after the window of the previous one is sequential,
+	the window then doubles.  the pages are mapped not accessed so the
+	clock takes them back first if they are never used.  
+	called within the s_pt_lock of p
+*/
+static void
+fault_around (struct process *p, struct list *file_table, struct file *file, 
+              struct fte *fte)
+{
+	uint32_t *pd = p->thread->pagedir;
+	struct inode *inode = file_get_inode(file);
+	struct list_elem *e;
+	size_t i;
 
-	//printf("victim vaddr : %p, paddr : %p, tid : %d\n", pte->vaddr, pte->paddr, pte->pid);
+	if (fte->vaddr == p->fault_next)
+		p->fault_window = p->fault_window * 2 > FAULT_AROUND_MAX 
+			? FAULT_AROUND_MAX : p->fault_window * 2;
+	else
+		p->fault_window = FAULT_AROUND_MIN;
+
+	e = list_next(&fte->elem);
+	for (i = 0; i < p->fault_window && e != list_end(file_table); i++){
+		struct fte *next = list_entry(e, struct fte, elem);
+		struct s_pte *entry;
+		struct frame *shared = NULL;
+		void *frame;
+		uint8_t *kpage;
+		bool exec, ok;
+
+		if (next->vaddr != (uint8_t *) fte->vaddr + (i + 1) * PGSIZE)
+			break;
+		entry = find_entry(next->vaddr, p);
+		ok = entry != NULL && entry->paddr == NULL 
+			&& entry->swap_slot == SWAP_SLOT_NONE
+			&& (entry->is_exec || entry->mmap_id > 0);
+		if (!ok)
+			break;
+		exec = entry->mmap_id <= 0;
+
+		/* bss is left to the zero frame */
+		if (exec && next->size == 0)
+			break;
+		if (exec && !next->writable)
+			shared = frame_lookup_share(inode, next->ofs);
+		if (shared != NULL){
+			pagedir_set_page (pd, next->vaddr, ptov((uintptr_t) shared->paddr), false, entry->mmap_id);
+			frame_set_pinned(shared->paddr, false);
+			e = list_next(e);
+			continue;
+		}
 
-	return pte;
+		if ((frame = get_spare_frame()) == NULL)
+			break;
+		kpage = ptov((uintptr_t) frame);
+		lock_acquire(&filesys_lock);
+		file_read_at(file, kpage, next->size, next->ofs);
+		lock_release(&filesys_lock);
+		memset(kpage + next->size, 0, PGSIZE - next->size);
+		pagedir_set_page (pd, next->vaddr, kpage, next->writable, entry->mmap_id);
+		if (exec && !next->writable)
+			frame_set_share(frame, inode, next->ofs);
+		e = list_next(e);
+	}
+	p->fault_next = (uint8_t *) fte->vaddr + (i + 1) * PGSIZE;
 }
 
 
+/* Returns the s_pte of vaddr in the table of p, or a null pointer if no 
+	such entry exists.  called within the s_pt_lock of p */
 struct s_pte *
-find_entry (void *vaddr, tid_t pid)
+find_entry (void *vaddr, struct process *p)
 {
-	
-	struct list_elem *e;
-  	struct s_pte* pte;
-  	for(e = list_begin(&s_page_table); e!= list_end(&s_page_table); e = list_next(e)){
-	    pte = list_entry(e, struct s_pte, elem);
-	    if (pte->pid == pid && pte->vaddr == vaddr){
-
-	    	return pte;
-	    }
-  	}
-	return NULL;		// no entry found
+	struct s_pte pte;
+	struct hash_elem *e;
 
+	if (p == NULL)
+		return NULL;
+	pte.vaddr = vaddr;
+	e = hash_find(&p->s_page_table, &pte.elem);
+	return e != NULL ? hash_entry (e, struct s_pte, elem) : NULL;
 }
 
+/*
+	when process terminate -> free entries in its s_pt too
+	called within the s_pt_lock of the process, which is held from
+	before its page directory is destroyed, so no eviction is still
+	looking at its pages
+*/
 void
-free_s_pte_process(tid_t pid)
+free_s_pte_process(struct process *p)
 {
-	struct list_elem *e;
-  	lock_acquire(&s_pt_lock);
-  	
-  	e = list_begin(&s_page_table);
-  	while (e!= list_end(&s_page_table))
-  	{
-  		struct s_pte* pte;
-  		pte = list_entry(e, struct s_pte, elem);
-  		ASSERT(e!= list_end(&s_page_table));
-  		e = list_next(e);
-	    if (pte->pid == pid){
-	    	void * vaddr = pte->vaddr;
-	    	list_remove(&pte->elem);
-	    	
-	    	free(pte);
-	    	//free_frame_entry(vaddr, pid);
-	    	
-	    }
-	   
-	    	
-  	}
-  	lock_release(&s_pt_lock);
+	ASSERT (lock_held_by_current_thread(&p->s_pt_lock));
+	hash_destroy(&p->s_page_table, s_pte_destroy);
+}
+
 
+/*
+	bool s_page_table_fork(struct process *parent, struct process *child)
+	from start_fork(), running as the child
+
+	copy every s_pte of parent but mmap pages (not inherited) to child.
+	1. resident page : the child maps the same frame.  a writable 
+		private page becomes read-only in both processes, it is 
+		copied on the first write (s_pte_cow_fault())
+	2. swapped out page : both hold the swap slot
+	3. not loaded exec page : stays lazy in the child
+	no page is copied here, the cost is one entry per page.
+	the parent is blocked in fork(), its s_pt_lock only keeps 
+	eviction off its pages meanwhile.
+*/
+bool
+s_page_table_fork (struct process *parent, struct process *child)
+{
+	uint32_t *ppd = parent->thread->pagedir;
+	uint32_t *cpd = child->thread->pagedir;
+	struct hash_iterator i;
+	bool success = true;
+
+	lock_acquire(&parent->s_pt_lock);
+	hash_first(&i, &parent->s_page_table);
+	while (hash_next(&i)){
+		struct s_pte *pte = hash_entry(hash_cur(&i), struct s_pte, elem);
+		struct s_pte *copy;
+		bool writable;
+
+		if (pte->mmap_id > 0)
+			continue;
+		copy = slab_alloc(&s_pte_cache);
+		if (copy == NULL){
+			success = false;
+			break;
+		}
+		writable = pte->cow || pagedir_is_writable(ppd, pte->vaddr);
+		copy->vaddr = pte->vaddr;
+		copy->paddr = NULL;
+		copy->proc = child;
+		copy->swap_slot = swap_dup(pte->swap_slot);
+		copy->is_exec = pte->is_exec;
+		copy->mmap_id = pte->mmap_id;
+		copy->cow = writable;
+		lock_acquire(&child->s_pt_lock);
+		hash_insert(&child->s_page_table, &copy->elem);
+		lock_release(&child->s_pt_lock);
+
+		if (pte->paddr != NULL){
+			struct frame *f = frame_lookup_paddr(pte->paddr);	/* NULL : zero frame */
+			if (writable && f != NULL && f->inode == NULL){
+				pagedir_set_writable(ppd, pte->vaddr, false);
+				pte->cow = true;
+			}
+			pagedir_set_page(cpd, copy->vaddr, ptov((uintptr_t) pte->paddr), false, copy->mmap_id);
+			/* eviction must still see that the frame differs from the file */
+			pagedir_set_dirty(cpd, copy->vaddr, pagedir_is_dirty(ppd, pte->vaddr));
+		}
+	}
+	lock_release(&parent->s_pt_lock);
+	return success;
+}
+
+
+/*
+	bool s_pte_cow_fault(void *vaddr, struct process *p)
+	from page_fault(), on a write to a present read-only page
+
+	if the page is shared copy-on-write or maps the zero frame, give 
+	the process its own writable copy, or just make it writable if no 
+	other process maps the frame any more, and return true.
+	if the page was evicted since the fault, return true too : the 
+	write is retried, and swaps the page in like any other fault.
+	otherwise the write is illegal, return false.
+	runs within the s_pt_lock of the process like find_s_pte().
+*/
+bool
+s_pte_cow_fault (void *vaddr, struct process *p)
+{
+	struct s_pte *entry;
+	uint32_t *pd;
+
+	if (p == NULL || (pd = p->thread->pagedir) == NULL)
+		return false;
+
+	lock_acquire(&p->s_pt_lock);
+	entry = find_entry(vaddr, p);
+	if (entry == NULL || !entry->cow){
+		lock_release(&p->s_pt_lock);
+		return false;
+	}
+	/* page_fault() saw the page present without any lock, eviction
+		may have taken it since : only the check within the s_pt_lock,
+		where no eviction of its pages runs, is reliable */
+	if (entry->paddr == NULL || pagedir_get_page(pd, vaddr) == NULL){
+		lock_release(&p->s_pt_lock);
+		return true;
+	}
+
+	if (entry->paddr != get_zero_frame() && frame_map_cnt(entry->paddr) == 1)
+		pagedir_set_writable(pd, vaddr, true);
+	else{
+		void *old = entry->paddr;
+		void *new;
+
+		/* keep the source from being evicted while a frame is found.
+			a new frame is zeroed already, the zero frame is not copied.
+			the other sharers may have exited meanwhile, the source is 
+			then left to this process and freed here */
+		frame_set_pinned(old, true);
+		new = get_free_frame();
+		if (old != get_zero_frame())
+			memcpy(ptov((uintptr_t) new), ptov((uintptr_t) old), PGSIZE);
+		frame_set_pinned(old, false);
+
+		if (free_frame_entry(entry))
+			palloc_free_page(ptov((uintptr_t) old));
+		s_pte_clear(vaddr, p);
+		pagedir_clear_page(pd, vaddr, p->pid);
+		pagedir_set_page(pd, vaddr, ptov((uintptr_t) new), true, entry->mmap_id);
+	}
+	entry->cow = false;
+	lock_release(&p->s_pt_lock);
+	return true;
 }
 
+
 /*
-	when process terminate -> free entries in s_pt too
+	map vaddr of p to the zero frame, read-only.  if the page is
+	writable it gets its own frame on the first write, like a 
+	copy-on-write page (s_pte_cow_fault()).  called within the 
+	s_pt_lock of the process
 */
+void
+s_pte_map_zero (void *vaddr, struct process *p, bool writable, int mmap_id)
+{
+	struct s_pte *entry;
 
+	pagedir_set_page(p->thread->pagedir, vaddr, ptov((uintptr_t) get_zero_frame()), 
+	                 false, mmap_id);
+	entry = find_entry(vaddr, p);
+	entry->cow = writable;
+}
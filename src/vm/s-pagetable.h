@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <hash.h>
 #include "threads/synch.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
@@ -17,25 +18,30 @@ what resources to free를 찾음
 */
 
 struct s_pte {
-	struct list_elem elem;			/* Hash table element */
+	struct hash_elem elem;			/* Hash table element (key : vaddr) */
 	void *vaddr;						/* virtual address */
 	void *paddr;						/* physical address */
-	tid_t pid;							/* process's pid that allocate this frame */
-	bool is_swapout;					/* ture : swapped out */
-	bool is_exec;					/* true : executable file */
+	struct process *proc;			/* process that maps this page, outlives its s_ptes */
+	size_t swap_slot;					/* swap slot of the page, SWAP_SLOT_NONE : not swapped out */
+	bool is_exec;					/* true : file backed, can be re-read from the file (exec or mmap) */
 	int mmap_id;					/* 0 : lazy loading, 1~ : mmap , -1 : normal case */
+	bool cow;						/* true : writable page mapped read-only, shared copy-on-write 
+									   after fork or mapping the zero frame */
+	struct list_elem frame_elem;	/* element in the reverse map of its frame */
 	/* 이 data가 file system / swap slot / all-zero page 중 어디에 있는지 알려줘야함 */
 
 };
 
 
-struct list s_page_table;
-
-void init_s_page_table(void);
-void s_pte_insert(void *, void *, tid_t, int);
-void s_pte_clear(void *, tid_t);
-void *find_s_pte(void *, tid_t);
-struct s_pte * get_victim(void);
-struct s_pte * find_entry(void *, tid_t);
-void free_s_pte_process(tid_t);
+void s_pte_init(void);
+void s_page_table_init(struct process *);
+bool s_pte_insert(void *, void *, struct process *, int);
+void s_pte_clear(void *, struct process *);
+void s_pte_remove(void *, struct process *);
+void *find_s_pte(void *, struct process *, bool);
+struct s_pte * find_entry(void *, struct process *);
+void free_s_pte_process(struct process *);
+bool s_page_table_fork(struct process *, struct process *);
+bool s_pte_cow_fault(void *, struct process *);
+void s_pte_map_zero(void *, struct process *, bool, int);
 
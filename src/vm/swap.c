@@ -1,4 +1,5 @@
 #include "vm/swap.h"
+#include <bitmap.h>
 #include <stdio.h>
 #include "threads/synch.h"
 #include "threads/palloc.h"
@@ -10,282 +11,297 @@
 #include "devices/disk.h"
 #include <string.h>
 #include "threads/vaddr.h"
+#include <round.h>
 #include "vm/frame.h"
+#include "vm/lz.h"
 
 
 static struct disk *disk;
-disk_sector_t sector;
-struct hash swap_table;
-struct lock swap_lock;
+static struct bitmap *swap_map;		/* in-use disk slots */
+static uint16_t *swap_ref;			/* number of s_ptes holding each slot */
+static size_t next_slot;			/* where the next free slot search starts */
+static struct lock swap_lock;
+
+/* compressed RAM tier.
+	the slots from disk_slot_cnt on are pages kept compressed in an 
+	arena of kernel pool pages, cut in chunks.  an evicted page goes 
+	there if it compresses to ZSWAP_MAX_LEN and the arena has room,
+	to the disk otherwise.  a compressed page takes at least one chunk,
+	so there are as many RAM slots as chunks. */
+#define ZSWAP_CHUNK 128				/* arena allocation unit, in bytes */
+#define ZSWAP_MAX_LEN (PGSIZE / 2)	/* largest compressed page kept */
+#define ZSWAP_ARENA_FRAC 8			/* arena : 1/8 of the user pool size */
+
+struct zswap_entry {
+	size_t chunk;					/* first chunk in the arena */
+	uint16_t len;					/* compressed size */
+};
+
+static size_t disk_slot_cnt;
+static size_t zswap_slot_cnt;
+static uint8_t *zswap_arena;
+static struct bitmap *zswap_chunks;	/* in-use arena chunks */
+static struct bitmap *zswap_map;	/* in-use RAM slots, from disk_slot_cnt */
+static struct zswap_entry *zswap_table;	/* indexed by RAM slot */
+static size_t next_zslot;			/* where the next free RAM slot search starts */
+static uint8_t *zswap_buf;			/* compression output */
+
+static void zswap_init (void);
+static size_t zswap_store (const void *);
+static void disk_slot_alloc (size_t *, size_t);
 
 
 void
 swap_init(void){
-	hash_init(&swap_table, swap_hash, swap_less, NULL);
-	lock_init(&swap_lock);
-	sector = 0;
 	/* Get Swap Disk */
 	disk = disk_get (1, 1);
 	if (disk == NULL)
 	    PANIC ("couldn't open target disk (swap or hd1:1)");
-}
 
-/* Returns a hash value for swap_entry s*/
-unsigned
-swap_hash (const struct hash_elem *s_, void *aux UNUSED)
-{
-	const struct swap_entry *s = hash_entry (s_, struct swap_entry, hash_elem);
-	return hash_bytes (&s->disksector, sizeof s->disksector);
+	disk_slot_cnt = disk_size (disk) / SECTORS_PER_SLOT;
+	swap_map = bitmap_create (disk_slot_cnt);
+	if (swap_map == NULL)
+		PANIC ("couldn't allocate swap slot bitmap");
+	zswap_init ();
+	swap_ref = calloc (disk_slot_cnt + zswap_slot_cnt, sizeof *swap_ref);
+	if (swap_ref == NULL)
+		PANIC ("couldn't allocate swap slot reference counts");
+	next_slot = 0;
+	lock_init(&swap_lock);
 }
 
-/* Returns true if frame a precedes page b */
-bool
-swap_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+/* set up the compressed RAM tier.  the arena is taken from the kernel
+	pool, halved until it fits.  with no arena at all every page just 
+	goes to the disk */
+static void
+zswap_init (void)
 {
-	const struct swap_entry *a = hash_entry (a_, struct swap_entry, hash_elem);
-	const struct swap_entry *b = hash_entry (b_, struct swap_entry, hash_elem);
+	size_t pages = palloc_user_page_cnt () / ZSWAP_ARENA_FRAC;
+
+	zswap_buf = palloc_get_page (0);
+	if (zswap_buf == NULL)
+		return;
+	for (; pages > 0; pages /= 2){
+		zswap_arena = palloc_get_multiple (0, pages);
+		if (zswap_arena != NULL)
+			break;
+	}
+	if (zswap_arena == NULL){
+		palloc_free_page (zswap_buf);
+		return;
+	}
 
-	return a->disksector < b->disksector;
+	zswap_slot_cnt = pages * PGSIZE / ZSWAP_CHUNK;
+	zswap_chunks = bitmap_create (zswap_slot_cnt);
+	zswap_map = bitmap_create (zswap_slot_cnt);
+	zswap_table = calloc (zswap_slot_cnt, sizeof *zswap_table);
+	if (zswap_chunks == NULL || zswap_map == NULL || zswap_table == NULL)
+		PANIC ("couldn't allocate compressed swap tables");
+	next_zslot = 0;
 }
 
 
-
 /* 
-TRACKS IN-USE AND FREE SWAP SLOTS
-
-1. "Picking an unused swap slot" for evicting a page from its frame to the swap partition
-2. "Freeing a swap slot" when its page is read back into frame / page가 swapped 된 process가 terminate
+	size_t swap_out(void *paddr)
+	from evict_frame()
 
+	swap out the single frame of paddr, return its slot.
+	the caller keeps it in the s_pte of the page.
 */
+size_t
+swap_out(void *paddr){
+	size_t slot;
 
+	swap_out_cluster(&paddr, &slot, 1);
+	return slot;
+}
 
 
-
-/* page fault시에 disk에서 불러옴 */
-void
-swap_in(void *paddr, void *vaddr, tid_t pid){
 /* 
-1. vaddr, pid을 가지고 있는 swap_entry 찾는다 
-2. disk_read로 free_frame에 읽어온다
-3. swap_table에서 swap_entry의 vaddr = NULL, pid = NULL
+	void swap_out_cluster(void **paddrs, size_t *slots, size_t cnt)
+	from evict_frame()
+
+	1. keep every frame that compresses well in the RAM tier, it needs 
+		no I/O at all.  slots[i] is the slot of paddrs[i].
+	2. pick contiguous unused disk slots for the others, starting from 
+		where the last search stopped, so that virtually adjacent pages 
+		are also adjacent on disk and can be read back together.
+	3. disk_write each of those frames to the 8 sectors of its slot.
 */
-	
-	lock_acquire(&swap_lock);
-	struct swap_entry *s;
-	uintptr_t swap_in_addr = (uintptr_t)paddr;
- 	disk_sector_t new_sector;
-	/* Find sector of vaddr */
-	s = swap_lookup_vaddr(vaddr, pid);
-	ASSERT(s != NULL);
-	new_sector = s->disksector;
-	//printf("SWAP IN  sector : %d, vaddr : %p\n", new_sector, vaddr);
-
-	int i;
-	for (i=0; i < PGSIZE/DISK_SECTOR_SIZE; i++){
-		//void *buffer;
-		//buffer = malloc (DISK_SECTOR_SIZE);
-		//if (buffer == NULL)
-		//	PANIC ("couldn't allocate buffer");
-		//printf("swap in pid : %d\n", thread_current()->tid);
-		/* Read from disk */
-		disk_read (disk, new_sector++, ptov(swap_in_addr));
-		//hex_dump((uintptr_t) (ptov(swap_in_addr)), (void **) (ptov(swap_in_addr)), 200, true);
-		/* Update swap table */
-		//memcpy (ptov((uintptr_t)paddr), buffer, DISK_SECTOR_SIZE);
-		
-		swap_in_addr += DISK_SECTOR_SIZE;
-		//free(buffer);
-	}
-	/* Allocate buffer. */
-	s->vaddr = NULL;
-	s->pid = (int)NULL;
-	lock_release(&swap_lock);
-	
+void
+swap_out_cluster(void **paddrs, size_t *slots, size_t cnt){
+	size_t disk_idx[SWAP_CLUSTER];		/* pages going to the disk */
+	size_t disk_slots[SWAP_CLUSTER];
+	size_t disk_cnt = 0;
+	size_t i;
 
-}
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
 
-/* frame에서 victim frame찾아서 swap out */
-void
-swap_out(void *paddr, void *vaddr, tid_t pid){
-/* 
-1. write 해줄 disk sector를 찾는다. (free인 sector)
-2. disk_write로 써준다.
-3. swap_table에 그 disk sector 추가
-*/
 	lock_acquire(&swap_lock);
-	struct swap_entry *s;
-  	//printf("SWAP OUT sector : %d, vaddr : %p\n", sector, vaddr);
-	
-	if(sector < disk_size(disk)-8){
-		/* Ready swap entry */
-		s = malloc (sizeof *s);
-		s->disksector = sector;
-		s->vaddr = vaddr;
-		s->pid = pid;
-		/* Disk write for linear 8 sectors */
-		int i;
-		for (i = 0; i<PGSIZE/DISK_SECTOR_SIZE; i++){
-			//void *buffer;
-			//buffer = malloc (DISK_SECTOR_SIZE);
-			//if (buffer == NULL)
-			//	PANIC ("couldn't allocate buffer");
-			//memset (buffer, 0, DISK_SECTOR_SIZE);
-			//memcpy (buffer, ptov((uintptr_t)paddr), DISK_SECTOR_SIZE);
-			//hex_dump((uintptr_t) ptov((uintptr_t)paddr), (void **) ptov((uintptr_t)paddr), 200, true);
-
-			//printf("paddr after: %p\n", paddr);
-			/* Write size to sector 1. */
-			disk_write (disk, sector++, ptov((uintptr_t)paddr));
-
-			paddr += DISK_SECTOR_SIZE;
-			//free(buffer);
-		}
-		
-		/* insert new swap entry into swap table */
-		hash_insert(&swap_table, &s->hash_elem);
-		//printf("sector : %d // disk size : %d\n", sector, disk_size(disk));
-		//printf("disk_write finish\n");
-		//ASSERT(0);
-	}
-	else{
-		// disk capacity 만큼 한번 다 돈 경우
-		s = swap_lookup_vaddr(NULL, NULL);
-		if (s == NULL){
-			ASSERT(0);
-			sys_exit(-1);
-		}
-		s->vaddr = vaddr;
-		s->pid = pid;
-		int disksector = s->disksector;
-		/* Disk write for linear 8 sectors */
-		int i;
-		for (i = 0; i<PGSIZE/DISK_SECTOR_SIZE; i++){
-			/*
-			void *buffer;
-			buffer = malloc (DISK_SECTOR_SIZE);
-			if (buffer == NULL)
-				PANIC ("couldn't allocate buffer");
-			memset (buffer, 0, DISK_SECTOR_SIZE);
-			memcpy (buffer, ptov((uintptr_t)paddr), DISK_SECTOR_SIZE);
-			paddr += DISK_SECTOR_SIZE;
-			//printf("paddr after: %p\n", paddr);*/
-			/* Write size to sector 1. */
-			disk_write (disk, disksector++, ptov((uintptr_t)paddr));
-			paddr += DISK_SECTOR_SIZE;
-			//free(buffer);
-		}
-		
-		/* insert new swap entry into swap table */
-		hash_insert(&swap_table, &s->hash_elem);
-		//disk_write (disk, s->disksector, buffer);
-
+	for (i = 0; i < cnt; i++){
+		slots[i] = zswap_store (ptov ((uintptr_t) paddrs[i]));
+		if (slots[i] == SWAP_SLOT_NONE)
+			disk_idx[disk_cnt++] = i;
 	}
+	if (disk_cnt > 0)
+		disk_slot_alloc (disk_slots, disk_cnt);
+	for (i = 0; i < disk_cnt; i++)
+		slots[disk_idx[i]] = disk_slots[i];
+	for (i = 0; i < cnt; i++)
+		swap_ref[slots[i]] = 1;
 	lock_release(&swap_lock);
 
-}
-
-
+	/* Disk write for linear 8 sectors of each slot */
+	for (i = 0; i < disk_cnt; i++){
+		disk_sector_t sector = disk_slots[i] * SECTORS_PER_SLOT;
+		uint8_t *kpage = ptov((uintptr_t) paddrs[disk_idx[i]]);
+		int j;
 
-void
-free_swap_slot_process(tid_t pid)
-{
-	struct hash_iterator i;
-	lock_acquire(&swap_lock);
-	hash_first (&i, &swap_table);
-	while (hash_next (&i))
-	{
-		struct swap_entry *s;
-		s= hash_entry (hash_cur (&i), struct swap_entry, hash_elem);
-		if (s->pid == pid){
-			s->vaddr = NULL;
-			s->pid = (int)NULL;
-		}
+		for (j = 0; j < SECTORS_PER_SLOT; j++)
+			disk_write (disk, sector + j, kpage + j * DISK_SECTOR_SIZE);
 	}
-	lock_release(&swap_lock);
 }
 
+/* compress the page at kpage into the RAM tier and return its slot,
+	or SWAP_SLOT_NONE if it does not compress well enough or does not 
+	fit in the arena.  called within swap_lock, which also guards 
+	zswap_buf and the state of the compressor */
+static size_t
+zswap_store (const void *kpage)
+{
+	size_t len, chunk, slot;
+
+	if (zswap_arena == NULL)
+		return SWAP_SLOT_NONE;
+	len = lz_compress (kpage, PGSIZE, zswap_buf, ZSWAP_MAX_LEN);
+	if (len == 0)
+		return SWAP_SLOT_NONE;
+	chunk = bitmap_scan_and_flip (zswap_chunks, 0, DIV_ROUND_UP (len, ZSWAP_CHUNK), false);
+	if (chunk == BITMAP_ERROR)
+		return SWAP_SLOT_NONE;
+
+	/* a page takes one chunk at least, a RAM slot is always left */
+	slot = bitmap_scan_and_flip (zswap_map, next_zslot, 1, false);
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip (zswap_map, 0, 1, false);
+	ASSERT (slot != BITMAP_ERROR);
+	next_zslot = slot + 1;
+
+	memcpy (zswap_arena + chunk * ZSWAP_CHUNK, zswap_buf, len);
+	zswap_table[slot].chunk = chunk;
+	zswap_table[slot].len = len;
+	return disk_slot_cnt + slot;
+}
 
-
-
-
-
-/* swap_table을 돌면서 vaddr을 기준으로 검색 */
-struct swap_entry *
-swap_lookup_vaddr(void *vaddr, tid_t pid)
+/* pick cnt unused disk slots, a contiguous run if there is one.
+	called within swap_lock */
+static void
+disk_slot_alloc (size_t *slots, size_t cnt)
 {
-	struct hash_iterator i;
-
-	hash_first (&i, &swap_table);
-	while (hash_next (&i))
-	{
-		struct swap_entry *s;
-		s = hash_entry (hash_cur (&i), struct swap_entry, hash_elem);
-		if (s->vaddr == vaddr && s->pid == pid){
-			return s;
+	size_t first;
+	size_t i;
+
+	first = bitmap_scan_and_flip (swap_map, next_slot, cnt, false);
+	if (first == BITMAP_ERROR)
+		first = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+	if (first != BITMAP_ERROR){
+		for (i = 0; i < cnt; i++)
+			slots[i] = first + i;
+	}
+	else{
+		for (i = 0; i < cnt; i++){
+			slots[i] = bitmap_scan_and_flip (swap_map, next_slot, 1, false);
+			if (slots[i] == BITMAP_ERROR)
+				slots[i] = bitmap_scan_and_flip (swap_map, 0, 1, false);
+			if (slots[i] == BITMAP_ERROR)
+				PANIC ("swap disk is full");
+			next_slot = slots[i] + 1;
 		}
 	}
-	return NULL;
+	next_slot = slots[cnt - 1] + 1;
 }
 
 
+/* 
+	void swap_in(void *paddr, size_t slot)
+	from find_s_pte()
 
+	1. RAM slot : decompress it into the frame of paddr.  the arena 
+		chunks stay put while this holder has the slot, no lock needed.
+	2. disk slot : disk_read its 8 sectors into the frame of paddr.
+	3. the slot is free again, unless a forked process still holds it.
+*/
+void
+swap_in(void *paddr, size_t slot){
+	uint8_t *kpage = ptov((uintptr_t) paddr);
 
+	ASSERT (slot != SWAP_SLOT_NONE);
 
+	if (slot >= disk_slot_cnt){
+		struct zswap_entry *e = &zswap_table[slot - disk_slot_cnt];
 
+		if (!lz_decompress (zswap_arena + e->chunk * ZSWAP_CHUNK, e->len, 
+		                    kpage, PGSIZE))
+			PANIC ("corrupt compressed swap slot %zu", slot);
+	}
+	else{
+		disk_sector_t sector = slot * SECTORS_PER_SLOT;
+		int i;
 
+		for (i = 0; i < SECTORS_PER_SLOT; i++)
+			disk_read (disk, sector + i, kpage + i * DISK_SECTOR_SIZE);
+	}
 
+	swap_free (slot);
+}
 
-
-
-
-
-
-
-
-
-
-
-/* 
-1. "Picking an unused swap slot" 
-for evicting a page from its frame to the swap partition
-
-void
-pick_unused_slot()
+/* Returns true if slot is in use.  called within swap_lock */
+static bool
+slot_in_use (size_t slot)
 {
-	get_swap_entry(NULL);
+	if (slot >= disk_slot_cnt)
+		return bitmap_test (zswap_map, slot - disk_slot_cnt);
+	return bitmap_test (swap_map, slot);
 }
 
-2. "Freeing a swap slot" 
-when its page is read back into frame / page가 swapped 된 process가 terminate
 
+/* drop one holder of swap slot, when its page is read back 
+	or the process of the page terminates.  the slot is free
+	when the last holder drops it */
 void
-free_swap_slot(uint32_t vaddr)
+swap_free(size_t slot)
 {
-	struct swap_entry * = get_swap_entry(vaddr);
-	//free swap_entry
-}
-*/
+	if (slot == SWAP_SLOT_NONE)
+		return;
 
-
-/* Returns the swap_entry containing the given virtual address, 
-	or a null pointer if no such frame exists 
-struct swap_entry *
-get_swap_entry(uint32_t vaddr, tid_t pid)
-{
-	struct hash_iterator i;
-
-	//pid도 함께 비교해 줘야함
-	hash_first (&i, frame_table);
-	while (hash_next (&i))
-	{
-		struct frame *f = hash_entry (hash_cur (&i), struct frame, elem);
-		if (f->vaddr == vaddr){
-			return f;
+	lock_acquire(&swap_lock);
+	ASSERT (slot_in_use (slot) && swap_ref[slot] > 0);
+	if (--swap_ref[slot] == 0){
+		if (slot >= disk_slot_cnt){
+			struct zswap_entry *e = &zswap_table[slot - disk_slot_cnt];
+
+			bitmap_set_multiple (zswap_chunks, e->chunk, 
+			                     DIV_ROUND_UP (e->len, ZSWAP_CHUNK), false);
+			bitmap_reset (zswap_map, slot - disk_slot_cnt);
 		}
+		else
+			bitmap_reset (swap_map, slot);
 	}
-	return NULL;
-
+	lock_release(&swap_lock);
 }
-*/
 
 
+/* add a holder to swap slot, when fork() copies the s_pte of 
+	a swapped out page.  returns slot */
+size_t
+swap_dup(size_t slot)
+{
+	if (slot == SWAP_SLOT_NONE)
+		return slot;
+
+	lock_acquire(&swap_lock);
+	ASSERT (slot_in_use (slot) && swap_ref[slot] < UINT16_MAX);
+	swap_ref[slot]++;
+	lock_release(&swap_lock);
+	return slot;
+}
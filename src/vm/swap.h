@@ -1,9 +1,10 @@
 #include <stdio.h>
-#include <hash.h>
+#include <stdint.h>
 #include "threads/synch.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "devices/disk.h"
@@ -15,27 +16,26 @@ TRACKS IN-USE AND FREE SWAP SLOTS
 1. "Picking an unused swap slot" for evicting a page from its frame to the swap partition
 2. "Freeing a swap slot" when its page is read back into frame / page가 swapped 된 process가 terminate
 
+the swap disk is divided into page sized slots, and a bitmap marks the slots in use.
+the slot of a swapped out page is kept in its s_pte (swap_slot), 
+so no table has to be searched to find or free it.
+slots past those of the disk are pages kept compressed in memory instead,
+every page that compresses well goes there first, while there is room.
 */
 
-struct swap_entry {
-	struct hash_elem hash_elem;			/* Hash table element */
-	disk_sector_t disksector;			/* disk sector num */
-	void *vaddr;						/* if not swapped : vaddr = NULL */
-	tid_t pid;							/* process's pid that allocate this frame */
+/* Number of sectors in one swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
 
-//	uint32_t paddr;						/* physical address */
-	/* 이 data가 file system / swap slot / all-zero page 중 어디에 있는지 알려줘야함 */
+/* Most pages swapped out or read ahead together. */
+#define SWAP_CLUSTER 8
 
-};
-
-
-struct hash swap_table;
+/* swap_slot of a page that is not swapped out. */
+#define SWAP_SLOT_NONE SIZE_MAX
 
 
 void swap_init(void);
-unsigned swap_hash (const struct hash_elem *, void * UNUSED);
-bool swap_less (const struct hash_elem *, const struct hash_elem *, void * UNUSED);
-void swap_in(void *, void *, tid_t);
-void swap_out(void *, void *, tid_t);
-void free_swap_slot_process(tid_t);
-struct swap_entry * swap_lookup_vaddr(void *, tid_t);
+size_t swap_out(void *);
+void swap_out_cluster(void **, size_t *, size_t);
+void swap_in(void *, size_t);
+void swap_free(size_t);
+size_t swap_dup(size_t);